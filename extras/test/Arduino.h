@@ -0,0 +1,43 @@
+/*
+ *  Arduino Buttons Library
+ *  An interrupt-driven, fully-debounced class to manage input from physical buttons on the Arduino platform.
+ *
+ *  Copyright (C) 2017 Nicholas Parks Young
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/**
+ * Just enough of the Arduino API to build the queues of the library on a desktop machine,
+ * for the host tests.
+ *
+ * Website: https://github.com/Alarm-Siren/arduino-buttons
+ *
+ *  DEFINITION FILE
+ *
+ * @author      Nicholas Parks Young
+ * @version     2.0.0
+ */
+
+#ifndef BUTTONS_TEST_ARDUINO_H
+#define BUTTONS_TEST_ARDUINO_H
+
+#include <stdint.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#endif
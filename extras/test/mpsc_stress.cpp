@@ -0,0 +1,217 @@
+/*
+ *  Arduino Buttons Library
+ *  An interrupt-driven, fully-debounced class to manage input from physical buttons on the Arduino platform.
+ *
+ *  Copyright (C) 2017 Nicholas Parks Young
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/**
+ * Host stress test of ButtonsMpscRing. Several threads push at once while one pops, and
+ * the test checks that every item pushed is popped exactly once, in order per producer,
+ * and that every push that failed was counted as an overflow.
+ *
+ * Website: https://github.com/Alarm-Siren/arduino-buttons
+ *
+ *  IMPLEMENTATION FILE
+ *
+ * @author      Nicholas Parks Young
+ * @version     2.0.0
+ */
+
+#include "ButtonsQueue.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/**
+ * An item pushed by a producer: which producer, and how many it had pushed before.
+ */
+struct Item
+{
+  uint16_t producer;
+  uint32_t sequence;
+};
+
+/**
+ * Runs one stress test, returning true if it passed.
+ *
+ * Each producer counts its own failed pushes, to be compared with the overflow count of the
+ * queue. Without retrying, a producer stops early once it has had its share of UINT16_MAX - 1
+ * failures, so the count never saturates and must match exactly. Retrying, the failures are
+ * not bounded, so a count that saturates is only checked to have done so.
+ *
+ * @param producers         Number of threads pushing at once.
+ * @param pushes            Number of pushes made by each producer.
+ * @param retry             true to push each item again until it fits, so that nothing is
+ *                          dropped, or false to drop an item that finds the queue full.
+ */
+template <byte SIZE>
+boolean stress(int producers, uint32_t pushes, boolean retry)
+{
+  static ButtonsMpscRing<Item, SIZE> queue;
+  queue = ButtonsMpscRing<Item, SIZE>();
+
+  const uint32_t failureShare = (UINT16_MAX - 1) / producers;
+  std::atomic<int> finished(0);
+  std::vector<uint32_t> pushed(producers, 0);
+  std::vector<uint64_t> failed(producers, 0);
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&, p]() {
+      uint32_t count = 0;
+      uint64_t failures = 0;
+      for (uint32_t i = 0; i < pushes; i++) {
+        const Item item = { (uint16_t)p, i };
+        if (retry) {
+          while (!queue.push(item)) {
+            failures++;
+            std::this_thread::yield();
+          }
+          count++;
+        } else if (queue.push(item)) {
+          count++;
+        } else if (++failures == failureShare) {
+          break;
+        } else {
+          // Give the consumer a chance to make room, so that most pushes get through.
+          std::this_thread::yield();
+        }
+        // Let the consumer and the other producers interleave with this one.
+        if ((i & 63) == 0)
+          std::this_thread::yield();
+      }
+      pushed[p] = count;
+      failed[p] = failures;
+      finished++;
+    });
+  }
+
+  // Pop until every producer has finished and the queue is empty.
+  std::vector<int64_t> last(producers, -1);
+  uint64_t popped = 0;
+  boolean ordered = true;
+  for (;;) {
+    const boolean done = (finished.load() == producers);
+    Item item;
+    while (queue.pop(item)) {
+      if ((int64_t)item.sequence <= last[item.producer])
+        ordered = false;
+      last[item.producer] = item.sequence;
+      popped++;
+    }
+    if (done)
+      break;
+    std::this_thread::yield();
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  uint64_t total = 0;
+  uint64_t failures = 0;
+  for (int p = 0; p < producers; p++) {
+    total += pushed[p];
+    failures += failed[p];
+  }
+  const boolean saturated = (failures >= UINT16_MAX);
+  const uint16_t overflows = saturated ? UINT16_MAX : (uint16_t)failures;
+
+  printf("SIZE %3d, %2d producers%s: pushed %llu, popped %llu, failed %llu, overflows %u%s\n",
+         SIZE, producers, retry ? " retrying" : "",
+         (unsigned long long)total, (unsigned long long)popped, (unsigned long long)failures,
+         queue.overflows(), saturated ? " (saturated)" : "");
+  boolean passed = true;
+  if (!ordered) {
+    puts("  FAIL: items from one producer popped out of order");
+    passed = false;
+  }
+  if (retry && total != (uint64_t)producers * pushes) {
+    puts("  FAIL: items lost despite retrying");
+    passed = false;
+  }
+  if (!retry && saturated) {
+    puts("  FAIL: failed pushes not kept below UINT16_MAX");
+    passed = false;
+  }
+  if (popped != total) {
+    puts("  FAIL: items popped do not match items pushed");
+    passed = false;
+  }
+  if (queue.overflows() != overflows) {
+    puts(saturated ? "  FAIL: overflows did not saturate" : "  FAIL: overflows do not match failed pushes");
+    passed = false;
+  }
+  if (!queue.empty()) {
+    puts("  FAIL: queue not empty at the end");
+    passed = false;
+  }
+  return passed;
+}
+
+/**
+ * Fills a queue and keeps pushing into it, returning true if the overflow count matched the
+ * failed pushes exactly up to UINT16_MAX, then stayed there.
+ */
+boolean saturate()
+{
+  static ButtonsMpscRing<Item, 4> queue;
+  queue = ButtonsMpscRing<Item, 4>();
+
+  boolean passed = true;
+  for (uint32_t i = 0; i < 4; i++) {
+    const Item item = { 0, i };
+    passed &= queue.push(item);
+  }
+  for (uint32_t failures = 1; failures <= UINT16_MAX + 10UL; failures++) {
+    const Item item = { 0, 4 };
+    passed &= !queue.push(item);
+    const uint16_t expected = (failures < UINT16_MAX) ? (uint16_t)failures : UINT16_MAX;
+    passed &= (queue.overflows() == expected);
+  }
+  Item item;
+  for (uint32_t i = 0; i < 4; i++) {
+    passed &= queue.pop(item) && item.sequence == i;
+  }
+  passed &= queue.empty();
+
+  printf("SIZE   4, saturating: overflows %u%s\n", queue.overflows(), passed ? "" : "\n  FAIL");
+  return passed;
+}
+
+}
+
+int main()
+{
+  boolean passed = true;
+  passed &= stress<4>(4, 200000, false);
+  passed &= stress<64>(8, 200000, false);
+  passed &= stress<16>(16, 50000, false);
+  passed &= stress<2>(3, 100000, false);
+  passed &= stress<64>(2, 10000, false);
+  passed &= stress<8>(6, 100000, true);
+  passed &= stress<2>(4, 50000, true);
+  passed &= stress<8>(6, 5000, true);
+  passed &= stress<2>(4, 5000, true);
+  passed &= saturate();
+  puts(passed ? "PASS" : "FAIL");
+  return passed ? 0 : 1;
+}
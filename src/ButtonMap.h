@@ -0,0 +1,140 @@
+/*
+ *  Arduino Buttons Library
+ *  An interrupt-driven, fully-debounced class to manage input from physical buttons on the Arduino platform.
+ *
+ *  Copyright (C) 2017 Nicholas Parks Young
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/**
+ * Compile-time binding of handler functions to buttons, for firmware whose buttons
+ * and handlers are fixed when it is built.
+ *
+ * Website: https://github.com/Alarm-Siren/arduino-buttons
+ *
+ *  DEFINITION FILE
+ *
+ * @author      Nicholas Parks Young
+ * @version     2.0.0
+ */
+
+#ifndef BUTTON_MAP_H
+#define BUTTON_MAP_H
+
+#include <Arduino.h>
+#include "Buttons.h"
+
+/**
+ * Binds a handler to a button, for use in a ButtonMap.
+ *
+ * @param Id            ID of the button.
+ * @param Handler       Function to call, passed true if the button is down and false if it is up.
+ * @param Triggers      ButtonsClass::ON_PRESS, ON_RELEASE or ON_CHANGE (the default).
+ */
+template <ButtonsClass::ButtonIndex Id, void (*Handler)(boolean down),
+          byte Triggers = ButtonsClass::ON_CHANGE>
+struct Bind final
+{
+  static_assert(Triggers != 0 && (Triggers & ~ButtonsClass::ON_CHANGE) == 0,
+                "Bind triggers must be ON_PRESS, ON_RELEASE or ON_CHANGE");
+
+  /**
+   * Calls the handler if this binding is for the specified button and change.
+   */
+  static inline void call(ButtonsClass::ButtonIndex buttonId, boolean down)
+  {
+    if (buttonId == Id && (Triggers & (down ? ButtonsClass::ON_PRESS : ButtonsClass::ON_RELEASE)))
+      Handler(down);
+  }
+};
+
+/**
+ * A set of handlers bound to buttons when the sketch is compiled:
+ *
+ *   typedef ButtonMap<Bind<0, startPressed, ButtonsClass::ON_PRESS>, Bind<1, stopChanged>> Controls;
+ *
+ *   void loop() {
+ *     Controls::dispatch();
+ *   }
+ *
+ * The bindings are template arguments, so they take no RAM, and each handler is called directly,
+ * where the compiler can inline it, rather than through a pointer. The test of each change against
+ * the bindings is a chain of comparisons with constants, which the compiler is free to turn into
+ * a jump table.
+ *
+ * @param Bindings      Any number of Bind types.
+ */
+template <typename... Bindings>
+class ButtonMap final
+{
+  public:
+
+    /**
+     * Calls the bound handlers for every button that has changed state since the last call,
+     * and clears the Change Flags of all the changed buttons, bound or not.
+     * Like ButtonsClass::dispatch(), only the changed buttons are looked at, and a button
+     * pressed and released again between two calls is reported only as released.
+     */
+    static void dispatch()
+    {
+      Buttons.forEachChanged(&ButtonMap::handle);
+    }
+
+    /**
+     * Calls the bound handlers for a single change of state.
+     * This can be used to feed the map from elsewhere, such as ButtonsClass::readEvent().
+     *
+     * @param buttonId          ID of the button.
+     * @param down              true if the button is now down, false if it is up.
+     */
+    static inline void handle(ButtonsClass::ButtonIndex buttonId, boolean down)
+    {
+      Chain<Bindings...>::call(buttonId, down);
+    }
+
+  private:
+
+    ButtonMap() = delete;
+
+    static void handle(ButtonsClass::ButtonIndex buttonId, boolean down, void* context)
+    {
+      (void)context;
+      handle(buttonId, down);
+    }
+
+    /**
+     * Tries each binding in turn.
+     */
+    template <typename... Rest>
+    struct Chain
+    {
+      static inline void call(ButtonsClass::ButtonIndex, boolean)
+      { }
+    };
+
+    template <typename First, typename... Rest>
+    struct Chain<First, Rest...>
+    {
+      static inline void call(ButtonsClass::ButtonIndex buttonId, boolean down)
+      {
+        First::call(buttonId, down);
+        Chain<Rest...>::call(buttonId, down);
+      }
+    };
+};
+
+#endif
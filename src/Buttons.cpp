@@ -40,12 +40,126 @@
  */
 
 #include "Buttons.h"
+#include <limits.h>
+#if defined(__AVR__)
+#include <avr/sleep.h>
+#endif
 //#include <initializer_list>
 
-byte ButtonsClass::_numberOfButtons = 0;
+ButtonsClass::ButtonIndex ButtonsClass::_numberOfButtons = 0;
+ButtonsClass::ButtonIndex ButtonsClass::_capacity = 0;
+boolean ButtonsClass::_ownsArrays = false;
 byte* ButtonsClass::_buttonPins = nullptr;
 volatile ButtonsClass::Button* ButtonsClass::_buttonStatus = nullptr;
+ButtonsClass::ChangeSet ButtonsClass::_changed;
 boolean ButtonsClass::_begun = false;
+volatile boolean ButtonsClass::_buttonWake = false;
+volatile boolean ButtonsClass::_settling = false;
+volatile unsigned long ButtonsClass::_settleStart = 0;
+volatile unsigned long ButtonsClass::_lastActivity = 0;
+volatile uint8_t ButtonsClass::_activityGeneration = 0;
+#if BUTTONS_FAST_QUERIES
+volatile byte ButtonsClass::_fastDown[(BUTTONS_FAST_QUERIES + 7) / 8];
+volatile byte ButtonsClass::_fastChanged[(BUTTONS_FAST_QUERIES + 7) / 8];
+#endif
+
+#if BUTTONS_LATENCY_TRACKING
+ButtonsClass::LatencyHistogram* ButtonsClass::_latency = nullptr;
+#endif
+
+#if BUTTONS_EVENT_QUEUE_SIZE
+ButtonsClass::IsrQueue<ButtonsClass::Event, BUTTONS_EVENT_QUEUE_SIZE> ButtonsClass::_transitions;
+ButtonsRing<ButtonsClass::Event, BUTTONS_EVENT_QUEUE_SIZE> ButtonsClass::_events;
+ButtonsClass::ButtonContext* ButtonsClass::_buttonContext = nullptr;
+ButtonsClass::IsrQueue<ButtonsClass::ButtonIndex, BUTTONS_EVENT_QUEUE_SIZE> ButtonsClass::_unsettled;
+ButtonsTimerWheel ButtonsClass::_timerWheel;
+unsigned long ButtonsClass::_nextDeadline = 0;
+boolean ButtonsClass::_timerArmed = false;
+#endif
+#if BUTTONS_TIMESTAMP_BITS < 32
+unsigned long ButtonsClass::_nextSweep = 0;
+#endif
+
+#if BUTTONS_MAX_CHORDS
+ButtonsClass::Chord ButtonsClass::_chords[BUTTONS_MAX_CHORDS];
+ButtonsClass::ButtonMask ButtonsClass::_downMask = 0;
+ButtonsClass::ButtonMask ButtonsClass::_deferredMask = 0;
+ButtonsClass::ButtonMask ButtonsClass::_claimedMask = 0;
+#endif
+
+#if BUTTONS_MAX_SEQUENCES
+ButtonsClass::ButtonIndex ButtonsClass::_sequences[BUTTONS_MAX_SEQUENCES][BUTTONS_MAX_SEQUENCE_LENGTH];
+byte ButtonsClass::_sequenceLengths[BUTTONS_MAX_SEQUENCES] = { 0 };
+ButtonsClass::ButtonIndex ButtonsClass::_sequenceButtons[BUTTONS_SEQUENCE_BUTTONS];
+byte ButtonsClass::_sequenceNext[BUTTONS_SEQUENCE_STATES][BUTTONS_SEQUENCE_BUTTONS];
+uint16_t ButtonsClass::_sequenceMatches[BUTTONS_SEQUENCE_STATES];
+byte ButtonsClass::_sequenceState = 0;
+unsigned long ButtonsClass::_sequenceLastPress = 0;
+uint16_t ButtonsClass::_sequenceTimeout = BUTTONS_SEQUENCE_TIMEOUT;
+byte ButtonsClass::_sequenceSymbols = 0;
+#endif
+
+#if BUTTONS_MAX_CALLBACKS
+ButtonsClass::Delegate ButtonsClass::_callbacks[BUTTONS_MAX_CALLBACKS];
+#endif
+
+#if BUTTONS_ARBITRATION
+void (* const ButtonsClass::_pinIsrs[ButtonsClass::ARBITRATION_BUTTONS])() = {
+  &ButtonsClass::pinISR<0>, &ButtonsClass::pinISR<1>, &ButtonsClass::pinISR<2>, &ButtonsClass::pinISR<3>,
+  &ButtonsClass::pinISR<4>, &ButtonsClass::pinISR<5>, &ButtonsClass::pinISR<6>, &ButtonsClass::pinISR<7>,
+  &ButtonsClass::pinISR<8>, &ButtonsClass::pinISR<9>, &ButtonsClass::pinISR<10>, &ButtonsClass::pinISR<11>,
+  &ButtonsClass::pinISR<12>, &ButtonsClass::pinISR<13>, &ButtonsClass::pinISR<14>, &ButtonsClass::pinISR<15>
+};
+volatile uint16_t ButtonsClass::_arbitrationMask = 0;
+volatile byte ButtonsClass::_arbitrationCount = 0;
+volatile ButtonsClass::ButtonIndex ButtonsClass::_arbitrationOrder[ButtonsClass::ARBITRATION_BUTTONS];
+volatile unsigned long ButtonsClass::_arbitrationTimes[ButtonsClass::ARBITRATION_BUTTONS];
+unsigned long ButtonsClass::_arbitrationStart = 0;
+#endif
+
+#if BUTTONS_RAW_EDGES
+ButtonsClass::ButtonCallback volatile ButtonsClass::_rawEdgeCallback = nullptr;
+void* volatile ButtonsClass::_rawEdgeContext = nullptr;
+#endif
+
+#if BUTTONS_AUTO_REPEAT
+uint16_t ButtonsClass::_repeatDelay = BUTTONS_REPEAT_DELAY;
+uint16_t ButtonsClass::_repeatInterval = BUTTONS_REPEAT_INTERVAL;
+byte ButtonsClass::_repeatAccelerateAfter = BUTTONS_REPEAT_ACCELERATE_AFTER;
+uint16_t ButtonsClass::_repeatMinInterval = BUTTONS_REPEAT_MIN_INTERVAL;
+#endif
+
+#if BUTTONS_GESTURES
+uint16_t ButtonsClass::_longPressTime = BUTTONS_LONG_PRESS_TIME;
+uint16_t ButtonsClass::_holdTime = BUTTONS_HOLD_TIME;
+uint16_t ButtonsClass::_multiClickWindow = BUTTONS_MULTI_CLICK_WINDOW;
+
+const ButtonsClass::GestureRule ButtonsClass::GESTURE_TABLE[GESTURE_STATES][GESTURE_INPUTS] PROGMEM = {
+  //                     PRESS                                 RELEASE                               TIMEOUT
+  /* IDLE      */ { { GESTURE_DOWN, GESTURE_START },      { GESTURE_IDLE, GESTURE_NONE },       { GESTURE_IDLE, GESTURE_NONE } },
+  /* DOWN      */ { { GESTURE_DOWN, GESTURE_NONE },       { GESTURE_UP_WAIT, GESTURE_CLICK_UP }, { GESTURE_DOWN_LONG, GESTURE_LONG } },
+  /* DOWN_LONG */ { { GESTURE_DOWN_LONG, GESTURE_NONE },  { GESTURE_IDLE, GESTURE_EMIT_LONG },  { GESTURE_HOLDING, GESTURE_EMIT_HOLD } },
+  /* HOLDING   */ { { GESTURE_HOLDING, GESTURE_NONE },    { GESTURE_IDLE, GESTURE_EMIT_UNHOLD }, { GESTURE_HOLDING, GESTURE_NONE } },
+  /* UP_WAIT   */ { { GESTURE_DOWN, GESTURE_ADD_PRESS },  { GESTURE_UP_WAIT, GESTURE_NONE },    { GESTURE_IDLE, GESTURE_EMIT_CLICKS } }
+};
+#endif
+
+#if BUTTONS_ISR_PROFILING
+volatile uint32_t ButtonsClass::_isrInvocations = 0;
+volatile uint32_t ButtonsClass::_isrMinTime = UINT32_MAX;
+volatile uint32_t ButtonsClass::_isrMaxTime = 0;
+volatile uint64_t ButtonsClass::_isrTotalTime = 0;
+volatile uint16_t ButtonsClass::_isrPeakRate = 0;
+volatile uint16_t ButtonsClass::_isrRateSlots[ButtonsClass::ISR_RATE_SLOTS] = { 0 };
+volatile unsigned long ButtonsClass::_isrRateEpoch = 0;
+#endif
+
+#if BUTTONS_ISR_PROFILING && BUTTONS_HAS_CYCLE_COUNTER
+// Cortex-M Data Watchpoint and Trace unit, used for cycle-accurate ISR timing.
+#define BUTTONS_DEMCR       (*(volatile uint32_t*)0xE000EDFCUL)
+#define BUTTONS_DWT_CTRL    (*(volatile uint32_t*)0xE0001000UL)
+#define BUTTONS_DWT_CYCCNT  (*(volatile uint32_t*)0xE0001004UL)
+#endif
 
 /**
  * TO DO
@@ -58,7 +172,7 @@ boolean ButtonsClass::_begun = false;
   }
 }*/
 
-boolean ButtonsClass::begin(const byte* const buttonPins, byte numberOfButtons)
+boolean ButtonsClass::begin(const byte* const buttonPins, ButtonIndex numberOfButtons)
 {
   // Abort if the buttonPins array is null
   if (nullptr == buttonPins)
@@ -69,29 +183,154 @@ boolean ButtonsClass::begin(const byte* const buttonPins, byte numberOfButtons)
     return false;
 
   // Setup internal storage buffers, etc.
-  _numberOfButtons = numberOfButtons;
-  _buttonPins = new byte[numberOfButtons];
-  _buttonStatus = new Button[numberOfButtons];
+  ButtonArrays arrays;
+  if (!allocateArrays(numberOfButtons, arrays))
+    return false;
+
+  return start(buttonPins, numberOfButtons, numberOfButtons, arrays, true);
+}
 
-  //Make sure that the memory was successfully allocated.
-  if (!_buttonPins || !_buttonStatus) {
+boolean ButtonsClass::allocateArrays(ButtonIndex count, ButtonArrays& arrays)
+{
+  arrays.pins = new byte[count];
+  arrays.status = new Button[count];
+  arrays.changed = new ChangeSet::Word[ChangeSet::words(count)];
+#if BUTTONS_LATENCY_TRACKING
+  arrays.latency = new LatencyHistogram[count];
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+  arrays.context = new ButtonContext[count];
+#endif
+
+  //Make sure that the memory was successfully allocated, and if not,
+  //don't leave any of it behind.
+  boolean allocated = arrays.pins && arrays.status && arrays.changed;
+#if BUTTONS_LATENCY_TRACKING
+  allocated = allocated && arrays.latency;
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+  allocated = allocated && arrays.context;
+#endif
+  if (!allocated)
+    freeArrays(arrays);
+  return allocated;
+}
+
+void ButtonsClass::freeArrays(const ButtonArrays& arrays)
+{
+  delete[] arrays.pins;
+  delete[] arrays.status;
+  delete[] arrays.changed;
+#if BUTTONS_LATENCY_TRACKING
+  delete[] arrays.latency;
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+  delete[] arrays.context;
+#endif
+}
+
+boolean ButtonsClass::start(const byte* const buttonPins, ButtonIndex numberOfButtons, ButtonIndex capacity,
+                            const ButtonArrays& arrays, boolean owned)
+{
+  if (nullptr == buttonPins || _begun)
     return false;
+
+  // Storage provided by the caller may have been used before, so start it afresh.
+  for (ButtonIndex i = 0; i < capacity; i++) {
+    arrays.pins[i] = NO_PIN;
+    arrays.status[i] = Button();
+#if BUTTONS_LATENCY_TRACKING
+    arrays.latency[i] = LatencyHistogram();
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+    arrays.context[i] = ButtonContext();
+#endif
+  }
+
+  _numberOfButtons = numberOfButtons;
+  _capacity = capacity;
+  _ownsArrays = owned;
+  _buttonPins = arrays.pins;
+  _buttonStatus = arrays.status;
+  _changed.attach(arrays.changed, capacity);
+#if BUTTONS_FAST_QUERIES
+  memset(const_cast<byte*>(_fastDown), 0, sizeof(_fastDown));
+  memset(const_cast<byte*>(_fastChanged), 0, sizeof(_fastChanged));
+#endif
+#if BUTTONS_LATENCY_TRACKING
+  _latency = arrays.latency;
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+  _buttonContext = arrays.context;
+
+  // Start with a clean slate, in case of a previous end().
+  _transitions.clear();
+  _events.clear();
+  _unsettled.clear();
+  _timerWheel.reset(millis());
+  _timerArmed = false;
+#endif
+#if BUTTONS_TIMESTAMP_BITS < 32
+  _nextSweep = millis() + SWEEP_INTERVAL;
+#endif
+#if BUTTONS_MAX_CHORDS
+  _downMask = 0;
+  _deferredMask = 0;
+  _claimedMask = 0;
+  for (byte c = 0; c < BUTTONS_MAX_CHORDS; c++) {
+    _chords[c].state = CHORD_IDLE;
+    _chords[c].holdTimer = ButtonsTimer();
   }
+#endif
 
   // Set up the input pins themselves.
-  for (byte i = 0; i < numberOfButtons; i++) {
+  for (ButtonIndex i = 0; i < numberOfButtons; i++) {
     _buttonPins[i] = buttonPins[i];
     pinMode(buttonPins[i], INPUT_PULLUP);
   }
-  
-  // Need to wait some time before setting up the ISRs, otherwise you can get spurious
-  // changes as the pullup hasn't quite done its magic yet.
-  delay(10);
+
+#if BUTTONS_ISR_PROFILING && BUTTONS_HAS_CYCLE_COUNTER
+  // Start the cycle counter used to time the ISR.
+  BUTTONS_DEMCR |= 0x01000000UL;     // TRCENA
+  BUTTONS_DWT_CTRL |= 0x00000001UL;  // CYCCNTENA
+#endif
+
+  // The pullups take a little while to do their magic, during which the pins can
+  // change spuriously. Rather than wait that out here, the ISR just follows the pins
+  // without reporting anything until PULLUP_SETTLE_TIME has passed.
+  startSettling();
+  _lastActivity = millis();
+
+#if BUTTONS_ARBITRATION
+  _arbitrationMask = 0;
+  _arbitrationCount = 0;
+  _arbitrationStart = micros();
+#endif
 
   //Set up the interrupts on the pins.
-  for (byte i = 0; i < numberOfButtons; i++) {
-    attachInterrupt(digitalPinToInterrupt(buttonPins[i]), &ButtonsClass::button_ISR, CHANGE);
+  for (ButtonIndex i = 0; i < numberOfButtons; i++) {
+    attachButton(i);
+  }
+
+  // Start from the actual state of each pin, so that a button held down from power-up
+  // reads as down. Any change from here on fires the ISR.
+  noInterrupts();
+  for (ButtonIndex i = 0; i < numberOfButtons; i++) {
+    const boolean readState = !digitalRead(buttonPins[i]);
+    _buttonStatus[i].currentState = readState;
+    mirrorState(i, readState);
+    restartBurst(i, millis());
+#if BUTTONS_TIMESTAMP_BITS < 32
+    // A compact time of zero could be recent, so start from one too old to debounce against.
+    _buttonStatus[i].lastChangeTime = timestamp(millis()) - SATURATED_TICKS;
+#endif
+#if BUTTONS_STORM_PROTECTION
+    _buttonStatus[i].rawState = readState;
+#endif
+    _buttonStatus[i].settling = true;
+    _buttonStatus[i].enabled = true;
   }
+  interrupts();
 
   // All done.
   _begun = true;
@@ -105,61 +344,642 @@ void ButtonsClass::end()
     return;
   
   //Disable the interrupts
-  for (byte i = 0; i < _numberOfButtons; i++) {
-    detachInterrupt(digitalPinToInterrupt(_buttonPins[i]));
+  for (ButtonIndex i = 0; i < _numberOfButtons; i++) {
+    if (_buttonPins[i] != NO_PIN)
+      detachInterrupt(digitalPinToInterrupt(_buttonPins[i]));
   }
-  
-  //Destroy dynamic memory.
-  delete[] _buttonPins;
-  delete[] _buttonStatus;
-  
-  //Object has been stopped.
+
+  // An interrupt could still be in flight, or one attached to a pin shared with something
+  // else could fire, so make sure the ISR has nothing to look at before freeing its memory.
+  byte* const buttonPins = _buttonPins;
+  volatile Button* const buttonStatus = _buttonStatus;
+  ChangeSet::Word* const changed = const_cast<ChangeSet::Word*>(_changed.storage());
+  noInterrupts();
   _begun = false;
+  _numberOfButtons = 0;
+  _buttonPins = nullptr;
+  _buttonStatus = nullptr;
+  interrupts();
+  _changed.detach();
+
+  //Destroy dynamic memory, unless it was provided to begin().
+  ButtonArrays arrays;
+  arrays.pins = buttonPins;
+  arrays.status = const_cast<Button*>(buttonStatus);
+  arrays.changed = changed;
+#if BUTTONS_LATENCY_TRACKING
+  arrays.latency = _latency;
+  _latency = nullptr;
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+  arrays.context = _buttonContext;
+  _buttonContext = nullptr;
+#endif
+  if (_ownsArrays)
+    freeArrays(arrays);
+  _capacity = 0;
+}
+
+ButtonsClass::ButtonIndex ButtonsClass::addButton(byte pin)
+{
+  if (!_begun)
+    return NO_BUTTON;
+
+  // Take the first free ID, making room for another if there isn't one.
+  ButtonIndex buttonId = 0;
+  while (buttonId < _numberOfButtons && _buttonPins[buttonId] != NO_PIN) {
+    buttonId++;
+  }
+  if (buttonId == _numberOfButtons) {
+    if (_numberOfButtons == NO_BUTTON || !resizeButtons(_numberOfButtons + 1))
+      return NO_BUTTON;
+  }
+
+  pinMode(pin, INPUT_PULLUP);
+  startSettling();
+
+  noInterrupts();
+  _buttonPins[buttonId] = pin;
+  const boolean readState = !digitalRead(pin);
+  _buttonStatus[buttonId].currentState = readState;
+  mirrorState(buttonId, readState);
+  restartBurst(buttonId, millis());
+#if BUTTONS_TIMESTAMP_BITS < 32
+  _buttonStatus[buttonId].lastChangeTime = timestamp(millis()) - SATURATED_TICKS;
+#endif
+#if BUTTONS_STORM_PROTECTION
+  _buttonStatus[buttonId].rawState = readState;
+#endif
+  _buttonStatus[buttonId].settling = true;
+  _buttonStatus[buttonId].enabled = true;
+  interrupts();
+
+  attachButton(buttonId);
+  return buttonId;
+}
+
+void ButtonsClass::removeButton(ButtonIndex buttonId)
+{
+  if (!_begun || buttonId >= _numberOfButtons || _buttonPins[buttonId] == NO_PIN)
+    return;
+
+  const byte pin = _buttonPins[buttonId];
+  noInterrupts();
+  _buttonStatus[buttonId].enabled = false;
+  interrupts();
+  detachInterrupt(digitalPinToInterrupt(pin));
+
+#if BUTTONS_EVENT_QUEUE_SIZE
+  stopButton(buttonId, true);
+#endif
+#if BUTTONS_LATENCY_TRACKING
+  _latency[buttonId] = LatencyHistogram();
+#endif
+
+  // Leave the ID free, and clean for whoever takes it next.
+  const Button blank;
+  noInterrupts();
+  _buttonPins[buttonId] = NO_PIN;
+  memcpy(const_cast<Button*>(&_buttonStatus[buttonId]), &blank, sizeof(Button));
+  mirrorState(buttonId, false);
+  clearChanged(buttonId);
+  interrupts();
+}
+
+void ButtonsClass::setEnabled(ButtonIndex buttonId, boolean enabled)
+{
+  if (!_begun || buttonId >= _numberOfButtons || _buttonPins[buttonId] == NO_PIN)
+    return;
+
+  volatile Button& button = _buttonStatus[buttonId];
+  if (enabled == button.enabled)
+    return;
+
+  if (!enabled) {
+    noInterrupts();
+    button.enabled = false;
+    interrupts();
+#if BUTTONS_EVENT_QUEUE_SIZE
+    stopButton(buttonId, false);
+#endif
+    return;
+  }
+
+  // Take up whatever state the pin is now in, without reporting it as a change.
+  noInterrupts();
+  const unsigned long now = millis();
+  const boolean readState = !digitalRead(_buttonPins[buttonId]);
+  button.currentState = readState;
+  mirrorState(buttonId, readState);
+  button.lastChangeTime = timestamp(now);
+  restartBurst(buttonId, now);
+#if BUTTONS_STORM_PROTECTION
+  button.rawState = readState;
+#endif
+  button.enabled = true;
+  interrupts();
+}
+
+boolean ButtonsClass::enabled(ButtonIndex buttonId)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return false;
+
+  return _buttonStatus[buttonId].enabled;
+}
+
+boolean ButtonsClass::resizeButtons(ButtonIndex count)
+{
+  // There may already be room. IDs past the end are always left free.
+  if (count <= _capacity) {
+    noInterrupts();
+    _numberOfButtons = count;
+    interrupts();
+    return true;
+  }
+  if (!_ownsArrays)
+    return false;
+
+  // Build the new arrays first, while the ISR carries on using the old ones.
+  ButtonArrays arrays;
+  if (!allocateArrays(count, arrays))
+    return false;
+
+  for (ButtonIndex i = 0; i < count; i++) {
+    arrays.pins[i] = (i < _numberOfButtons) ? _buttonPins[i] : NO_PIN;
+  }
+#if BUTTONS_LATENCY_TRACKING
+  for (ButtonIndex i = 0; i < _numberOfButtons; i++) {
+    arrays.latency[i] = _latency[i];
+  }
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+  // The timer wheel links timers by address, so armed timers must be moved across to it.
+  for (ButtonIndex i = 0; i < _numberOfButtons; i++) {
+    arrays.context[i] = _buttonContext[i];
+    for (byte kind = 0; kind < TIMER_BUTTON_KINDS; kind++) {
+      ButtonsTimer& from = _buttonContext[i].timers[kind];
+      ButtonsTimer& to = arrays.context[i].timers[kind];
+      to = ButtonsTimer();
+      to.kind = from.kind;
+      to.index = from.index;
+      if (from.armed()) {
+        const unsigned long deadline = from.deadline;
+        _timerWheel.cancel(from);
+        _timerWheel.schedule(to, deadline);
+      }
+    }
+  }
+#endif
+
+  // Only the button state is touched by the ISR, so that is the only thing that has to be
+  // copied with it held off, along with the swap itself.
+  ButtonArrays old;
+  old.pins = _buttonPins;
+  old.status = const_cast<Button*>(_buttonStatus);
+  old.changed = const_cast<ChangeSet::Word*>(_changed.storage());
+  ChangeSet changed;
+  changed.attach(arrays.changed, count);
+  noInterrupts();
+  for (ButtonIndex i = 0; i < _numberOfButtons; i++) {
+    memcpy(&arrays.status[i], old.status + i, sizeof(Button));
+  }
+  for (ButtonIndex i = _changed.next(0); i != ChangeSet::NONE; i = _changed.next(i + 1)) {
+    changed.set(i);
+  }
+  _buttonPins = arrays.pins;
+  _buttonStatus = arrays.status;
+  _changed = changed;
+  _numberOfButtons = count;
+  interrupts();
+  _capacity = count;
+
+#if BUTTONS_LATENCY_TRACKING
+  old.latency = _latency;
+  _latency = arrays.latency;
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+  old.context = _buttonContext;
+  _buttonContext = arrays.context;
+#endif
+  freeArrays(old);
+  return true;
+}
+
+void ButtonsClass::attachButton(ButtonIndex buttonId)
+{
+  void (*isr)() = &ButtonsClass::button_ISR;
+#if BUTTONS_ARBITRATION
+  if (buttonId < ARBITRATION_BUTTONS)
+    isr = _pinIsrs[buttonId];
+#endif
+  attachInterrupt(digitalPinToInterrupt(_buttonPins[buttonId]), isr, CHANGE);
+}
+
+void ButtonsClass::startSettling()
+{
+  noInterrupts();
+  const unsigned long now = millis();
+  // Any buttons left from a settle period that the ISR has not been back to see the end of
+  // are settled by now, so must not be held back by this one.
+  if (_settling && now - _settleStart >= PULLUP_SETTLE_TIME) {
+    for (ButtonIndex i = 0; i < _numberOfButtons; i++) {
+      _buttonStatus[i].settling = false;
+    }
+  }
+  _settleStart = now;
+  _settling = true;
+  interrupts();
+}
+
+#if BUTTONS_ISR_PROFILING
+inline uint32_t ButtonsClass::profileTimestamp()
+{
+#if BUTTONS_HAS_CYCLE_COUNTER
+  return BUTTONS_DWT_CYCCNT;
+#else
+  return micros();
+#endif
+}
+#endif
+
+inline void ButtonsClass::acceptTransition(ButtonIndex buttonId, boolean state, unsigned long now)
+{
+  volatile Button& button = _buttonStatus[buttonId];
+
+  button.currentState = state;
+  mirrorState(buttonId, state);
+  setChanged(buttonId);
+  _activityGeneration++;
+  _lastActivity = now;
+  _activityGeneration++;
+  volatile ClickCount& count = state ? button.presses : button.releases;
+  if (count != (ClickCount)~(ClickCount)0)
+    count++;
+#if BUTTONS_EVENT_QUEUE_SIZE
+  const Event transition = { state ? EVENT_PRESS : EVENT_RELEASE, buttonId, now };
+  _transitions.push(transition);
+#endif
+#if BUTTONS_LATENCY_TRACKING
+  button.acceptedAt = micros();
+  button.latencyPending = true;
+#endif
+#if BUTTONS_STATISTICS
+  if (button.stats.transitions != UINT16_MAX)
+    button.stats.transitions++;
+#endif
+  restartBurst(buttonId, now);
+}
+
+inline void ButtonsClass::setChanged(ButtonIndex buttonId)
+{
+  _changed.set(buttonId);
+#if BUTTONS_FAST_QUERIES
+  if (buttonId < BUTTONS_FAST_QUERIES)
+    _fastChanged[buttonId / 8] |= (byte)(1 << (buttonId % 8));
+#endif
+}
+
+inline void ButtonsClass::clearChanged(ButtonIndex buttonId)
+{
+  _changed.clear(buttonId);
+#if BUTTONS_FAST_QUERIES
+  if (buttonId < BUTTONS_FAST_QUERIES)
+    _fastChanged[buttonId / 8] &= (byte)~(1 << (buttonId % 8));
+#endif
+}
+
+inline void ButtonsClass::mirrorState(ButtonIndex buttonId, boolean state)
+{
+#if BUTTONS_FAST_QUERIES
+  if (buttonId >= BUTTONS_FAST_QUERIES)
+    return;
+  if (state)
+    _fastDown[buttonId / 8] |= (byte)(1 << (buttonId % 8));
+  else
+    _fastDown[buttonId / 8] &= (byte)~(1 << (buttonId % 8));
+#else
+  (void)buttonId;
+  (void)state;
+#endif
+}
+
+inline void ButtonsClass::restartBurst(ButtonIndex buttonId, unsigned long now)
+{
+#if BUTTONS_STATISTICS
+  _buttonStatus[buttonId].burstEdges = 0;
+  _buttonStatus[buttonId].burstStart = (uint16_t)now;
+#else
+  (void)buttonId;
+  (void)now;
+#endif
+}
+
+inline ButtonsClass::Timestamp ButtonsClass::timestamp(unsigned long time)
+{
+  return (Timestamp)(time / BUTTONS_TIMESTAMP_TICK);
+}
+
+inline unsigned long ButtonsClass::elapsedSince(Timestamp stamp, unsigned long now)
+{
+  const Timestamp ticks = timestamp(now) - stamp;
+#if BUTTONS_TIMESTAMP_BITS < 32
+  if (ticks >= SATURATED_TICKS)
+    return MAX_ELAPSED;
+#endif
+  return (unsigned long)ticks * BUTTONS_TIMESTAMP_TICK;
+}
+
+inline unsigned long ButtonsClass::timeOf(Timestamp stamp, unsigned long now)
+{
+  return now - now % BUTTONS_TIMESTAMP_TICK - elapsedSince(stamp, now);
+}
+
+inline unsigned long ButtonsClass::settledAt(Timestamp stamp, unsigned long now)
+{
+  return timeOf(stamp, now) + (DEBOUNCE_TICKS + 1) * BUTTONS_TIMESTAMP_TICK;
+}
+
+inline void ButtonsClass::rejectEdge(ButtonIndex buttonId, unsigned long now)
+{
+#if BUTTONS_STATISTICS
+  volatile Button& button = _buttonStatus[buttonId];
+#endif
+  (void)buttonId;
+  (void)now;
+
+#if BUTTONS_EVENT_QUEUE_SIZE
+  // If this turns out to be the last edge of the bounce, the button will be left in a different
+  // state to the one accepted, so have update() check it once the bounce has settled.
+  requestConfirm(buttonId);
+#endif
+#if BUTTONS_STATISTICS
+  // Account the edge against the burst that follows the last accepted transition.
+  volatile Statistics& stats = button.stats;
+  if (stats.bounces != UINT16_MAX)
+    stats.bounces++;
+  if (button.burstEdges != UINT8_MAX)
+    button.burstEdges++;
+  if (button.burstEdges > stats.maxBounceBurst)
+    stats.maxBounceBurst = button.burstEdges;
+  const uint16_t burstDuration = (uint16_t)now - button.burstStart;
+  if (burstDuration > stats.maxBounceDuration)
+    stats.maxBounceDuration = burstDuration;
+#endif
+}
+
+#if BUTTONS_EVENT_QUEUE_SIZE
+inline void ButtonsClass::requestConfirm(ButtonIndex buttonId)
+{
+  volatile Button& button = _buttonStatus[buttonId];
+
+  if (!button.confirmPending && _unsettled.push(buttonId))
+    button.confirmPending = true;
+}
+#endif
+
+#if BUTTONS_RAW_EDGES
+inline void ButtonsClass::rawEdge(ButtonIndex buttonId, boolean state, unsigned long now)
+{
+  volatile Button& button = _buttonStatus[buttonId];
+
+  // The whole point is to get here quickly, so make the callback before anything else.
+  const ButtonCallback callback = _rawEdgeCallback;
+  if (callback)
+    callback(buttonId, state, _rawEdgeContext);
+
+  // An edge is only accepted after the pin has sat in the state of the last accepted edge
+  // for the debounce period, so any earlier transition still outstanding was real, and has
+  // settled without update() getting to it.
+  if (button.provisional) {
+    const Event settled = { EVENT_EDGE_CONFIRMED, buttonId, now };
+    _transitions.push(settled);
+  }
+  button.provisional = true;
+  requestConfirm(buttonId);
+}
+#endif
+
+#if BUTTONS_STORM_PROTECTION
+inline boolean ButtonsClass::stormEdge(ButtonIndex buttonId, unsigned long now)
+{
+  volatile Button& button = _buttonStatus[buttonId];
+
+  if ((uint16_t)((uint16_t)now - button.stormWindowStart) >= BUTTONS_STORM_WINDOW) {
+    button.stormWindowStart = (uint16_t)now;
+    button.stormEdges = 0;
+  }
+  if (++button.stormEdges < BUTTONS_STORM_EDGES)
+    return false;
+
+  // Only quarantine the button if update() can be told to poll it; otherwise leave it
+  // on interrupts, and try again when it next goes over the limit.
+  const Event quarantine = { EVENT_QUARANTINE, buttonId, now };
+  button.stormEdges = 0;
+  if (!_transitions.push(quarantine))
+    return false;
+
+  button.quarantined = true;
+  detachInterrupt(digitalPinToInterrupt(_buttonPins[buttonId]));
+  return true;
 }
+#endif
 
 void ButtonsClass::button_ISR()
 {
-  for (byte i = 0; i < _numberOfButtons; i++) {
+  serviceButtons(0, _numberOfButtons);
+}
+
+#if BUTTONS_ARBITRATION
+template <byte N>
+void ButtonsClass::pinISR()
+{
+  // Time the edge before anything else, so that every button is timed alike.
+  const unsigned long time = micros();
+
+  if (N >= _numberOfButtons)
+    return;
+  serviceButtons(N, N + 1);
+  arbitrate(N, time);
+}
+
+inline void ButtonsClass::arbitrate(byte buttonId, unsigned long time)
+{
+  const uint16_t bit = (uint16_t)1 << buttonId;
+  if ((_arbitrationMask & bit) || _buttonStatus[buttonId].settling || !_buttonStatus[buttonId].enabled)
+    return;
+
+  // Only a press counts; the edge may as well be a release or bounce.
+  if (digitalRead(_buttonPins[buttonId]))
+    return;
+
+  _arbitrationMask |= bit;
+  _arbitrationTimes[_arbitrationCount] = time;
+  _arbitrationOrder[_arbitrationCount] = buttonId;
+  _arbitrationCount++;
+}
+#endif
+
+inline void ButtonsClass::serviceButtons(ButtonIndex first, ButtonIndex end)
+{
+#if BUTTONS_ISR_PROFILING
+  const uint32_t start = profileTimestamp();
+#endif
+
+  _buttonWake = true;
+
+  const unsigned long now = millis();
+  const Timestamp stamp = timestamp(now);
+
+  // Until their pullups have settled, silently follow the pins of the buttons just started.
+  // The other buttons carry on as normal.
+  if (_settling) {
+    const boolean settled = now - _settleStart >= PULLUP_SETTLE_TIME;
+    for (ButtonIndex i = 0; i < _numberOfButtons; i++) {
+      if (!_buttonStatus[i].settling)
+        continue;
+      if (settled) {
+        _buttonStatus[i].settling = false;
+        continue;
+      }
+      if (!_buttonStatus[i].enabled)
+        continue;
+      const boolean readState = !digitalRead(_buttonPins[i]);
+      _buttonStatus[i].generation++;
+      _buttonStatus[i].currentState = readState;
+      mirrorState(i, readState);
+      _buttonStatus[i].lastChangeTime = stamp;
+      restartBurst(i, now);
+      _buttonStatus[i].generation++;
+#if BUTTONS_STORM_PROTECTION
+      _buttonStatus[i].rawState = readState;
+#endif
+    }
+    if (settled)
+      _settling = false;
+  }
+
+  for (ButtonIndex i = first; i < end; i++) {
+    if (!_buttonStatus[i].enabled || _buttonStatus[i].settling)
+      continue;
+#if BUTTONS_STORM_PROTECTION
+    // Quarantined buttons are polled by update() instead.
+    if (_buttonStatus[i].quarantined)
+      continue;
+#endif
     const boolean readState = !digitalRead(_buttonPins[i]);
+#if BUTTONS_STORM_PROTECTION
+    if (readState != _buttonStatus[i].rawState) {
+      _buttonStatus[i].rawState = readState;
+      if (stormEdge(i, now))
+        continue;
+    }
+#endif
     if (readState != _buttonStatus[i].currentState) {
-      if (millis() > _buttonStatus[i].lastChangeTime + DEBOUNCE_DELAY) {
-        _buttonStatus[i].currentState = readState;
-        _buttonStatus[i].changeFlag = true;
+      // Odd from here until the button is consistent again; see stateInfo().
+      _buttonStatus[i].generation++;
+      if ((Timestamp)(stamp - _buttonStatus[i].lastChangeTime) > DEBOUNCE_TICKS) {
+#if BUTTONS_RAW_EDGES
+        rawEdge(i, readState, now);
+#endif
+        acceptTransition(i, readState, now);
+      } else {
+        rejectEdge(i, now);
       }
-      _buttonStatus[i].lastChangeTime = millis();
+      _buttonStatus[i].lastChangeTime = stamp;
+      _buttonStatus[i].generation++;
     }
   }
+
+#if BUTTONS_ISR_PROFILING
+  recordIsrProfile(start);
+#endif
+}
+
+#if BUTTONS_ISR_PROFILING
+void ButtonsClass::recordIsrProfile(uint32_t start)
+{
+  const uint32_t elapsed = profileTimestamp() - start;
+
+  // The count and the total saturate together, so that the mean stays that of the runs counted.
+  if (_isrInvocations != UINT32_MAX) {
+    _isrInvocations++;
+    _isrTotalTime += elapsed;
+  }
+  if (elapsed < _isrMinTime)
+    _isrMinTime = elapsed;
+  if (elapsed > _isrMaxTime)
+    _isrMaxTime = elapsed;
+
+  // Interrupt rate is counted into sub-windows; any that have been passed over since the
+  // last invocation are emptied so the sum of all of them covers the most recent window.
+  const unsigned long epoch = millis() / (BUTTONS_ISR_RATE_WINDOW / ISR_RATE_SLOTS);
+  const unsigned long passed = epoch - _isrRateEpoch;
+  for (byte i = 1; i <= ISR_RATE_SLOTS && i <= passed; i++) {
+    _isrRateSlots[(_isrRateEpoch + i) % ISR_RATE_SLOTS] = 0;
+  }
+  _isrRateEpoch = epoch;
+
+  volatile uint16_t& slot = _isrRateSlots[epoch % ISR_RATE_SLOTS];
+  if (slot != UINT16_MAX)
+    slot++;
+
+  uint32_t rate = 0;
+  for (byte i = 0; i < ISR_RATE_SLOTS; i++) {
+    rate += _isrRateSlots[i];
+  }
+  if (rate > _isrPeakRate)
+    _isrPeakRate = (rate > UINT16_MAX) ? UINT16_MAX : rate;
 }
+#endif
 
-boolean ButtonsClass::clicked(byte buttonId)
+boolean ButtonsClass::clicked(ButtonIndex buttonId)
 {
-  return changed(buttonId) && down(buttonId);
+  const boolean result = changed(buttonId) && down(buttonId);
+#if BUTTONS_LATENCY_TRACKING
+  if (result)
+    consumeTransition(buttonId);
+#endif
+  return result;
 }
 
-boolean ButtonsClass::released(byte buttonId)
+boolean ButtonsClass::released(ButtonIndex buttonId)
 {
-  return changed(buttonId) && !down(buttonId);
+  const boolean result = changed(buttonId) && !down(buttonId);
+#if BUTTONS_LATENCY_TRACKING
+  if (result)
+    consumeTransition(buttonId);
+#endif
+  return result;
 }
 
-boolean ButtonsClass::down(byte buttonId)
+boolean ButtonsClass::down(ButtonIndex buttonId)
 {
   if (!_begun)
     return false;
-  
+#if BUTTONS_DEBUG
+  if (buttonId >= _numberOfButtons)
+    return false;
+#endif
+
   return  _buttonStatus[buttonId].currentState;
 }
 
-boolean ButtonsClass::up(byte buttonId)
+boolean ButtonsClass::up(ButtonIndex buttonId)
 {
   return !down(buttonId);
 }
 
-boolean ButtonsClass::changed(byte buttonId)
+boolean ButtonsClass::changed(ButtonIndex buttonId)
 {
   if (!_begun)
     return false;
-  
-  return _buttonStatus[buttonId].changeFlag;
+#if BUTTONS_DEBUG
+  if (buttonId >= _numberOfButtons)
+    return false;
+#endif
+
+  return _changed.test(buttonId);
 }
 
 void ButtonsClass::clearChangeFlag()
@@ -167,27 +987,1304 @@ void ButtonsClass::clearChangeFlag()
   if (!_begun)
     return;
   
-  for (byte i = 0; i < _numberOfButtons; i++) {
-    _buttonStatus[i].changeFlag = false;
+  // Only the buttons that have changed need looking at.
+  for (ButtonIndex i = _changed.next(0); i != ChangeSet::NONE; i = _changed.next(i + 1)) {
+#if BUTTONS_LATENCY_TRACKING
+    consumeTransition(i);
+#endif
+    noInterrupts();
+    clearChanged(i);
+    interrupts();
   }
 }
 
-void ButtonsClass::clearChangeFlag(byte buttonId)
+void ButtonsClass::clearChangeFlag(ButtonIndex buttonId)
 {
   if (!_begun)
     return;
 
-    _buttonStatus[buttonId].changeFlag = false;
+#if BUTTONS_DEBUG
+  if (buttonId >= _numberOfButtons)
+    return;
+#endif
+
+#if BUTTONS_LATENCY_TRACKING
+  if (_changed.test(buttonId))
+    consumeTransition(buttonId);
+#endif
+  noInterrupts();
+  clearChanged(buttonId);
+  interrupts();
 }
 
+ButtonsClass::ButtonIndex ButtonsClass::nextChanged(size_t from)
+{
+  if (!_begun || from >= _numberOfButtons)
+    return NO_BUTTON;
+
+  const ButtonIndex buttonId = _changed.next(from);
+  return (buttonId < _numberOfButtons) ? buttonId : NO_BUTTON;
+}
 
-byte ButtonsClass::numberOfButtons()
+void ButtonsClass::forEachChanged(ButtonCallback callback, void* context)
 {
-  if (_begun) {
-    return _numberOfButtons;
-  } else {
-    return 0;
+  if (!_begun || _changed.empty())
+    return;
+
+  for (ButtonIndex i = _changed.next(0); i != ChangeSet::NONE; i = _changed.next(i + 1)) {
+    noInterrupts();
+    clearChanged(i);
+    const boolean state = _buttonStatus[i].currentState;
+    interrupts();
+#if BUTTONS_LATENCY_TRACKING
+    consumeTransition(i);
+#endif
+    callback(i, state, context);
+  }
+}
+
+ButtonsClass::StateInfo ButtonsClass::stateInfo(ButtonIndex buttonId)
+{
+  StateInfo info = StateInfo();
+  if (!_begun || buttonId >= _numberOfButtons)
+    return info;
+
+  // A seqlock: the ISR makes the generation odd while it updates the button, and it ends
+  // up different once it has, so a read that starts and ends on the same even generation
+  // saw no update at all. The main program can never see it odd on a single core, as the
+  // ISR always finishes before returning to it; the test is there for completeness.
+  // The time is read inside the loop so that it cannot be from before the last change.
+  volatile Button& button = _buttonStatus[buttonId];
+  uint8_t generation;
+  Timestamp stamp;
+  unsigned long now;
+  do {
+    generation = button.generation;
+    info.down = button.currentState;
+    info.changed = _changed.test(buttonId);
+    stamp = button.lastChangeTime;
+    now = millis();
+  } while ((generation & 1) || generation != button.generation);
+
+  info.lastChangeTime = timeOf(stamp, now);
+  info.idleFor = elapsedSince(stamp, now);
+  if (info.down)
+    info.heldFor = info.idleFor;
+  return info;
+}
+
+unsigned long ButtonsClass::heldFor(ButtonIndex buttonId)
+{
+  return stateInfo(buttonId).heldFor;
+}
+
+unsigned long ButtonsClass::idleFor(ButtonIndex buttonId)
+{
+  return stateInfo(buttonId).idleFor;
+}
+
+unsigned long ButtonsClass::lastChangeAt(ButtonIndex buttonId)
+{
+  return stateInfo(buttonId).lastChangeTime;
+}
+
+unsigned long ButtonsClass::lastActivity()
+{
+  // Read as stateInfo() reads a button.
+  uint8_t generation;
+  unsigned long time;
+  do {
+    generation = _activityGeneration;
+    time = _lastActivity;
+  } while ((generation & 1) || generation != _activityGeneration);
+  return time;
+}
+
+#if BUTTONS_MAX_CALLBACKS
+int8_t ButtonsClass::onPress(ButtonIndex buttonId, ButtonCallback callback, void* context)
+{
+  return addDelegate(buttonId, 0, ON_PRESS, callback, context);
+}
+
+int8_t ButtonsClass::onRelease(ButtonIndex buttonId, ButtonCallback callback, void* context)
+{
+  return addDelegate(buttonId, 0, ON_RELEASE, callback, context);
+}
+
+int8_t ButtonsClass::onChange(ButtonIndex buttonId, ButtonCallback callback, void* context)
+{
+  return addDelegate(buttonId, 0, ON_CHANGE, callback, context);
+}
+
+int8_t ButtonsClass::addCallback(ButtonMask buttons, byte triggers, ButtonCallback callback, void* context)
+{
+  if (buttons == 0)
+    return -1;
+
+  return addDelegate(NO_BUTTON, buttons, triggers, callback, context);
+}
+
+int8_t ButtonsClass::addDelegate(ButtonIndex buttonId, ButtonMask mask, byte triggers,
+                                 ButtonCallback callback, void* context)
+{
+  triggers &= ON_CHANGE;
+  if (triggers == 0 || nullptr == callback)
+    return -1;
+
+  for (byte c = 0; c < BUTTONS_MAX_CALLBACKS; c++) {
+    Delegate& delegate = _callbacks[c];
+    if (delegate.triggers != 0)
+      continue;
+
+    delegate.function = callback;
+    delegate.context = context;
+    delegate.mask = mask;
+    delegate.buttonId = buttonId;
+    delegate.triggers = triggers;
+    return c;
   }
+  return -1;
+}
+
+void ButtonsClass::removeCallback(byte callbackId)
+{
+  if (callbackId >= BUTTONS_MAX_CALLBACKS)
+    return;
+
+  _callbacks[callbackId].triggers = 0;
+}
+
+void ButtonsClass::dispatch()
+{
+  forEachChanged(&ButtonsClass::dispatchChange);
+}
+
+void ButtonsClass::dispatchChange(ButtonIndex buttonId, boolean down, void* context)
+{
+  (void)context;
+  const byte trigger = down ? ON_PRESS : ON_RELEASE;
+  const ButtonMask bit = (buttonId < 32) ? (ButtonMask)1 << buttonId : 0;
+
+  for (byte c = 0; c < BUTTONS_MAX_CALLBACKS; c++) {
+    const Delegate& delegate = _callbacks[c];
+    if (!(delegate.triggers & trigger))
+      continue;
+
+    if (delegate.buttonId == NO_BUTTON ? (delegate.mask & bit) != 0 : delegate.buttonId == buttonId)
+      delegate.function(buttonId, down, delegate.context);
+  }
+}
+#endif
+
+#if BUTTONS_ARBITRATION
+void ButtonsClass::resetArbitration()
+{
+  noInterrupts();
+  _arbitrationMask = 0;
+  _arbitrationCount = 0;
+  _arbitrationStart = micros();
+  interrupts();
+}
+
+ButtonsClass::ButtonIndex ButtonsClass::arbitrationWinner()
+{
+  noInterrupts();
+  const ButtonIndex winner = (_arbitrationCount > 0) ? _arbitrationOrder[0] : NO_BUTTON;
+  interrupts();
+  return winner;
+}
+
+void ButtonsClass::arbitration(Arbitration& result)
+{
+  noInterrupts();
+  result.startedAt = _arbitrationStart;
+  result.count = _arbitrationCount;
+  for (byte i = 0; i < result.count; i++) {
+    result.order[i] = _arbitrationOrder[i];
+    result.times[i] = _arbitrationTimes[i];
+  }
+  interrupts();
+}
+#endif
+
+#if BUTTONS_RAW_EDGES
+void ButtonsClass::onRawEdge(ButtonCallback callback, void* context)
+{
+  noInterrupts();
+  _rawEdgeCallback = callback;
+  _rawEdgeContext = context;
+  interrupts();
+}
+#endif
+
+ButtonsClass::ButtonIndex ButtonsClass::numberOfButtons()
+{
+  if (_begun) {
+    return _numberOfButtons;
+  } else {
+    return 0;
+  }
+}
+
+boolean ButtonsClass::sleepUntilEvent(unsigned long timeout)
+{
+  if (!_begun)
+    return false;
+
+  const unsigned long start = millis();
+  boolean limited = (timeout != 0);
+  unsigned long wakeAt = start + timeout;
+#if BUTTONS_HAS_UPDATE
+  unsigned long deadline;
+  if (nextDeadline(deadline) && (!limited || (long)(deadline - wakeAt) < 0)) {
+    limited = true;
+    wakeAt = deadline;
+  }
+#endif
+
+  _buttonWake = false;
+  while (!_buttonWake && !(limited && (long)(millis() - wakeAt) >= 0)) {
+    sleepUntilInterrupt();
+  }
+  return _buttonWake;
+}
+
+void ButtonsClass::sleepUntilInterrupt()
+{
+#if defined(__AVR__)
+  // Interrupts are held off between checking the flag and sleeping, or a button interrupt
+  // in between would be missed until the next tick. The instruction after sei always runs
+  // before any pending interrupt, so sleep_cpu() is reached with the interrupt still pending.
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  noInterrupts();
+  if (!_buttonWake) {
+    sleep_enable();
+    interrupts();
+    sleep_cpu();
+    sleep_disable();
+  } else {
+    interrupts();
+  }
+#elif defined(__arm__)
+  // An interrupt becoming pending wakes WFI even while interrupts are masked,
+  // and is then taken as soon as they are unmasked.
+  noInterrupts();
+  if (!_buttonWake)
+    __asm__ __volatile__("wfi" ::: "memory");
+  interrupts();
+#else
+  yield();
+#endif
+}
+
+ButtonsClass::ClickCount ButtonsClass::clickCount(ButtonIndex buttonId)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return 0;
+
+  return readCount(_buttonStatus[buttonId].presses, false);
+}
+
+ButtonsClass::ClickCount ButtonsClass::takeClickCount(ButtonIndex buttonId)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return 0;
+
+  return readCount(_buttonStatus[buttonId].presses, true);
+}
+
+ButtonsClass::ClickCount ButtonsClass::releaseCount(ButtonIndex buttonId)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return 0;
+
+  return readCount(_buttonStatus[buttonId].releases, false);
+}
+
+ButtonsClass::ClickCount ButtonsClass::takeReleaseCount(ButtonIndex buttonId)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return 0;
+
+  return readCount(_buttonStatus[buttonId].releases, true);
+}
+
+ButtonsClass::ClickCount ButtonsClass::readCount(volatile ClickCount& counter, boolean reset)
+{
+  // A single byte can be read without tearing, but anything wider, or a read-modify-write,
+  // has to hold off the ISR.
+  if (sizeof(ClickCount) == 1 && !reset)
+    return counter;
+
+  noInterrupts();
+  const ClickCount result = counter;
+  if (reset)
+    counter = 0;
+  interrupts();
+  return result;
+}
+
+#if BUTTONS_HAS_UPDATE
+void ButtonsClass::update()
+{
+  if (!_begun)
+    return;
+
+  const unsigned long now = millis();
+#if BUTTONS_TIMESTAMP_BITS < 32
+  if ((long)(now - _nextSweep) >= 0)
+    sweepTimestamps(now);
+#endif
+
+#if BUTTONS_EVENT_QUEUE_SIZE
+  // Nothing else to do unless the ISR has queued something or a timer has come due.
+  if (_transitions.empty() && _unsettled.empty()
+      && !(_timerArmed && (long)(now - _nextDeadline) >= 0))
+    return;
+
+  // Confirm each unsettled button once it has been quiet for the debounce period, which may
+  // already have passed if update() has not been called for a while.
+  ButtonIndex unsettled;
+  while (_unsettled.pop(unsettled)) {
+    noInterrupts();
+    const Timestamp lastChangeTime = _buttonStatus[unsettled].lastChangeTime;
+    const unsigned long settled = settledAt(lastChangeTime, millis());
+    interrupts();
+    setTimer(TIMER_DEBOUNCE, unsettled, settled);
+  }
+
+  // Confirming a debounce may itself queue a transition, so go round until there are none.
+  do {
+    Event transition;
+    while (_transitions.pop(transition)) {
+      // Anything that came due before the transition happened must be dealt with first,
+      // otherwise a late update() could, for example, see a long press as a click.
+      expireTimers(transition.time);
+      processTransition(transition);
+    }
+    expireTimers(now);
+  } while (!_transitions.empty());
+#endif
+}
+
+boolean ButtonsClass::nextDeadline(unsigned long& deadline)
+{
+  if (!_begun)
+    return false;
+
+  boolean pending = false;
+#if BUTTONS_EVENT_QUEUE_SIZE
+  if (!_transitions.empty() || !_unsettled.empty()) {
+    deadline = millis();
+    return true;
+  }
+  pending = _timerWheel.nextDeadline(deadline);
+#endif
+#if BUTTONS_TIMESTAMP_BITS < 32
+  if (!pending || (long)(_nextSweep - deadline) < 0) {
+    deadline = _nextSweep;
+    pending = true;
+  }
+#endif
+  return pending;
+}
+
+#if BUTTONS_TIMESTAMP_BITS < 32
+void ButtonsClass::sweepTimestamps(unsigned long now)
+{
+  const Timestamp stamp = timestamp(now);
+  for (ButtonIndex i = 0; i < _numberOfButtons; i++) {
+    noInterrupts();
+    volatile Button& button = _buttonStatus[i];
+    if ((Timestamp)(stamp - button.lastChangeTime) > SATURATED_TICKS)
+      button.lastChangeTime = stamp - SATURATED_TICKS;
+    interrupts();
+  }
+  _nextSweep = now + SWEEP_INTERVAL;
+}
+#endif
+#endif
+
+#if BUTTONS_EVENT_QUEUE_SIZE
+boolean ButtonsClass::readEvent(Event& event)
+{
+  if (!_begun)
+    return false;
+
+  if (!_events.pop(event))
+    return false;
+
+#if BUTTONS_LATENCY_TRACKING
+  if (event.type == EVENT_PRESS || event.type == EVENT_RELEASE)
+    consumeTransition(event.buttonId);
+#endif
+  return true;
+}
+
+uint16_t ButtonsClass::droppedEvents()
+{
+  noInterrupts();
+  const uint32_t dropped = (uint32_t)_transitions.overflows() + _events.overflows();
+  interrupts();
+  return (dropped > UINT16_MAX) ? UINT16_MAX : dropped;
+}
+
+void ButtonsClass::processTransition(const Event& transition)
+{
+#if BUTTONS_RAW_EDGES
+  if (transition.type == EVENT_EDGE_CONFIRMED || transition.type == EVENT_EDGE_CANCELLED) {
+    postEvent(transition.type, transition.buttonId, transition.time);
+    return;
+  }
+#endif
+#if BUTTONS_STORM_PROTECTION
+  if (transition.type == EVENT_QUARANTINE) {
+    startQuarantine(transition.buttonId, transition.time);
+    return;
+  }
+#endif
+#if BUTTONS_MAX_CHORDS
+  if (transition.buttonId < 32
+      && !chordTransition(transition.type, transition.buttonId, transition.time))
+    return;
+#endif
+
+  deliverTransition(transition.type, transition.buttonId, transition.time);
+}
+
+void ButtonsClass::deliverTransition(EventType type, ButtonIndex buttonId, unsigned long time)
+{
+  postEvent(type, buttonId, time);
+
+#if BUTTONS_GESTURES
+  gestureInput(buttonId, (type == EVENT_PRESS) ? GESTURE_IN_PRESS : GESTURE_IN_RELEASE, time);
+#endif
+#if BUTTONS_MAX_SEQUENCES
+  if (type == EVENT_PRESS)
+    sequenceInput(buttonId, time);
+#endif
+#if BUTTONS_AUTO_REPEAT
+  ButtonContext& context = _buttonContext[buttonId];
+  if (type == EVENT_PRESS && context.repeatEnabled) {
+    context.repeatCount = 0;
+    context.repeatInterval = _repeatInterval;
+    setTimer(TIMER_REPEAT, buttonId, time + _repeatDelay);
+  } else {
+    cancelTimer(TIMER_REPEAT, buttonId);
+  }
+#endif
+}
+
+void ButtonsClass::postEvent(EventType type, ButtonIndex buttonId, unsigned long time)
+{
+  const Event event = { type, buttonId, time };
+  _events.push(event);
+}
+
+ButtonsTimer& ButtonsClass::timer(TimerKind kind, ButtonIndex index)
+{
+#if BUTTONS_MAX_CHORDS
+  if (kind == TIMER_CHORD)
+    return _chords[index].holdTimer;
+#endif
+  return _buttonContext[index].timers[kind];
+}
+
+void ButtonsClass::setTimer(TimerKind kind, ButtonIndex index, unsigned long when)
+{
+  ButtonsTimer& t = timer(kind, index);
+  t.kind = kind;
+  t.index = index;
+  _timerWheel.schedule(t, when);
+
+  if (!_timerArmed || (long)(when - _nextDeadline) < 0) {
+    _nextDeadline = when;
+    _timerArmed = true;
+  }
+}
+
+void ButtonsClass::cancelTimer(TimerKind kind, ButtonIndex index)
+{
+  _timerWheel.cancel(timer(kind, index));
+}
+
+void ButtonsClass::expireTimers(unsigned long now)
+{
+  if (!_timerArmed || (long)(now - _nextDeadline) < 0)
+    return;
+
+  while (ButtonsTimer* t = _timerWheel.expire(now)) {
+    timerExpired((TimerKind)t->kind, t->index, t->deadline);
+  }
+  _timerArmed = _timerWheel.nextDeadline(_nextDeadline);
+}
+
+void ButtonsClass::timerExpired(TimerKind kind, ButtonIndex index, unsigned long when)
+{
+  switch (kind) {
+    case TIMER_DEBOUNCE:
+      confirmDebounce(index);
+      break;
+
+#if BUTTONS_GESTURES
+    case TIMER_GESTURE:
+      gestureInput(index, GESTURE_IN_TIMEOUT, when);
+      break;
+#endif
+#if BUTTONS_MAX_CHORDS
+    case TIMER_CHORD_DEFER:
+      releaseDeferredPress(index);
+      break;
+
+    case TIMER_CHORD:
+      if (_chords[index].state == CHORD_COMPLETE) {
+        _chords[index].state = CHORD_FIRED;
+        postEvent(EVENT_CHORD, index, when);
+      }
+      break;
+#endif
+#if BUTTONS_AUTO_REPEAT
+    case TIMER_REPEAT:
+      autoRepeat(index, when);
+      break;
+#endif
+#if BUTTONS_STORM_PROTECTION
+    case TIMER_QUARANTINE:
+      pollQuarantined(index, when);
+      break;
+#endif
+    default:
+      (void)index;
+      (void)when;
+      break;
+  }
+}
+
+void ButtonsClass::confirmDebounce(ButtonIndex buttonId)
+{
+  volatile Button& button = _buttonStatus[buttonId];
+
+  noInterrupts();
+  if (!button.enabled) {
+    button.confirmPending = false;
+#if BUTTONS_RAW_EDGES
+    button.provisional = false;
+#endif
+    interrupts();
+    return;
+  }
+#if BUTTONS_STORM_PROTECTION
+  // A quarantined button's state is kept up to date by polling.
+  if (button.quarantined) {
+    button.confirmPending = false;
+#if BUTTONS_RAW_EDGES
+    button.provisional = false;
+#endif
+    interrupts();
+    return;
+  }
+#endif
+  const unsigned long now = millis();
+  const unsigned long settled = settledAt(button.lastChangeTime, now);
+  if ((long)(now - settled) < 0) {
+    // Still bouncing; try again once it should have stopped.
+    interrupts();
+    setTimer(TIMER_DEBOUNCE, buttonId, settled);
+    return;
+  }
+
+  button.confirmPending = false;
+  const boolean readState = !digitalRead(_buttonPins[buttonId]);
+#if BUTTONS_RAW_EDGES
+  // Settle the last raw edge first, so that a cancellation comes before the
+  // transition that puts the button back.
+  if (button.provisional) {
+    button.provisional = false;
+    const Event settled = { (readState == button.currentState) ? EVENT_EDGE_CONFIRMED : EVENT_EDGE_CANCELLED,
+                            buttonId, now };
+    _transitions.push(settled);
+  }
+#endif
+  if (readState != button.currentState) {
+    acceptTransition(buttonId, readState, now);
+    button.lastChangeTime = timestamp(now);
+  }
+  interrupts();
+}
+
+void ButtonsClass::stopButton(ButtonIndex buttonId, boolean removing)
+{
+  ButtonContext& context = _buttonContext[buttonId];
+
+#if BUTTONS_MAX_CHORDS
+  // Let go of any chords the button is part of, but drop rather than deliver
+  // any press of it that was being held back.
+  if (buttonId < 32) {
+    _deferredMask &= ~((ButtonMask)1 << buttonId);
+    if (_downMask & ((ButtonMask)1 << buttonId))
+      chordTransition(EVENT_RELEASE, buttonId, millis());
+  }
+#endif
+
+  // A quarantined button carries on being polled while disabled, so that it is not
+  // put back on interrupts while its pin is still storming.
+  for (byte kind = 0; kind < TIMER_BUTTON_KINDS; kind++) {
+#if BUTTONS_STORM_PROTECTION
+    if (kind == TIMER_QUARANTINE && !removing)
+      continue;
+#endif
+    if (kind == TIMER_DEBOUNCE && !removing)
+      continue;
+    _timerWheel.cancel(context.timers[kind]);
+  }
+
+  if (removing) {
+    context = ButtonContext();
+    return;
+  }
+#if BUTTONS_GESTURES
+  context.gestureState = GESTURE_IDLE;
+  context.gestureClicks = 0;
+#endif
+#if BUTTONS_AUTO_REPEAT
+  context.repeatCount = 0;
+#endif
+}
+#endif
+
+#if BUTTONS_STORM_PROTECTION
+boolean ButtonsClass::quarantined(ButtonIndex buttonId)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return false;
+
+  return _buttonStatus[buttonId].quarantined;
+}
+
+void ButtonsClass::startQuarantine(ButtonIndex buttonId, unsigned long time)
+{
+  ButtonContext& context = _buttonContext[buttonId];
+
+  postEvent(EVENT_QUARANTINE, buttonId, time);
+  context.pollState = !digitalRead(_buttonPins[buttonId]);
+  context.quietSince = time;
+  setTimer(TIMER_QUARANTINE, buttonId, time + BUTTONS_STORM_POLL_INTERVAL);
+}
+
+void ButtonsClass::pollQuarantined(ButtonIndex buttonId, unsigned long when)
+{
+  ButtonContext& context = _buttonContext[buttonId];
+  volatile Button& button = _buttonStatus[buttonId];
+
+  // A level is only accepted once it has been read the same on two polls in a row,
+  // which debounces it as long as the poll interval is longer than the bounce.
+  const boolean readState = !digitalRead(_buttonPins[buttonId]);
+  if (readState != context.pollState) {
+    context.pollState = readState;
+    context.quietSince = when;
+  } else if (readState != button.currentState && button.enabled) {
+    noInterrupts();
+    acceptTransition(buttonId, readState, when);
+    button.lastChangeTime = timestamp(when);
+    interrupts();
+  }
+
+  if ((long)(when - context.quietSince) < BUTTONS_STORM_QUIET_TIME) {
+    setTimer(TIMER_QUARANTINE, buttonId, when + BUTTONS_STORM_POLL_INTERVAL);
+    return;
+  }
+
+  // The pin has gone quiet, so put it back on interrupts. It could have changed between
+  // the poll and the interrupt being attached, so check it again once that has settled.
+  noInterrupts();
+  if (!button.enabled) {
+    button.currentState = readState;
+    mirrorState(buttonId, readState);
+  }
+  button.rawState = readState;
+  button.stormEdges = 0;
+  button.stormWindowStart = (uint16_t)when;
+  button.quarantined = false;
+  button.confirmPending = true;
+  interrupts();
+  attachButton(buttonId);
+  setTimer(TIMER_DEBOUNCE, buttonId, when + DEBOUNCE_DELAY + 1);
+  postEvent(EVENT_QUARANTINE_END, buttonId, when);
+}
+#endif
+
+#if BUTTONS_GESTURES
+void ButtonsClass::setGestureTiming(uint16_t longPressTime, uint16_t holdTime, uint16_t multiClickWindow)
+{
+  _longPressTime = longPressTime;
+  _holdTime = holdTime;
+  _multiClickWindow = multiClickWindow;
+}
+
+void ButtonsClass::enableGestures(ButtonIndex buttonId, boolean enabled)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return;
+
+  ButtonContext& context = _buttonContext[buttonId];
+  context.gesturesEnabled = enabled;
+  if (!enabled) {
+    context.gestureState = GESTURE_IDLE;
+    cancelTimer(TIMER_GESTURE, buttonId);
+  }
+}
+
+void ButtonsClass::gestureInput(ButtonIndex buttonId, GestureInput input, unsigned long time)
+{
+  ButtonContext& context = _buttonContext[buttonId];
+  if (!context.gesturesEnabled)
+    return;
+
+  byte next = pgm_read_byte(&GESTURE_TABLE[context.gestureState][input].next);
+  const byte action = pgm_read_byte(&GESTURE_TABLE[context.gestureState][input].action);
+
+  switch (action) {
+    case GESTURE_START:
+      context.gestureClicks = 1;
+      context.gesturePressTime = time;
+      setTimer(TIMER_GESTURE, buttonId, time + _longPressTime);
+      break;
+
+    case GESTURE_ADD_PRESS:
+      context.gestureClicks++;
+      context.gesturePressTime = time;
+      setTimer(TIMER_GESTURE, buttonId, time + _longPressTime);
+      break;
+
+    case GESTURE_CLICK_UP:
+      if (context.gestureClicks >= 3) {
+        // Nothing beyond a triple click is recognised, so there's no point waiting.
+        emitClicks(buttonId, context.gestureClicks, time);
+        cancelTimer(TIMER_GESTURE, buttonId);
+        next = GESTURE_IDLE;
+      } else {
+        setTimer(TIMER_GESTURE, buttonId, time + _multiClickWindow);
+      }
+      break;
+
+    case GESTURE_LONG:
+      // The last press of a multi-click turned into a long press; the clicks before
+      // it still happened.
+      if (context.gestureClicks > 1)
+        emitClicks(buttonId, context.gestureClicks - 1, time);
+      setTimer(TIMER_GESTURE, buttonId, context.gesturePressTime + _holdTime);
+      break;
+
+    case GESTURE_EMIT_LONG:
+      cancelTimer(TIMER_GESTURE, buttonId);
+      postEvent(EVENT_LONG_PRESS, buttonId, time);
+      break;
+
+    case GESTURE_EMIT_HOLD:
+      postEvent(EVENT_HOLD_START, buttonId, time);
+      break;
+
+    case GESTURE_EMIT_UNHOLD:
+      postEvent(EVENT_HOLD_END, buttonId, time);
+      break;
+
+    case GESTURE_EMIT_CLICKS:
+      emitClicks(buttonId, context.gestureClicks, time);
+      break;
+
+    default:
+      break;
+  }
+
+  context.gestureState = next;
+}
+
+void ButtonsClass::emitClicks(ButtonIndex buttonId, byte clicks, unsigned long time)
+{
+  if (clicks > 3)
+    clicks = 3;
+  postEvent((EventType)(EVENT_CLICK + clicks - 1), buttonId, time);
+}
+#endif
+
+#if BUTTONS_MAX_CHORDS
+int8_t ButtonsClass::addChord(ButtonMask buttons, uint16_t holdTime, uint16_t tolerance, boolean suppress)
+{
+  if (buttons == 0)
+    return -1;
+
+  for (byte c = 0; c < BUTTONS_MAX_CHORDS; c++) {
+    Chord& chord = _chords[c];
+    if (chord.mask != 0)
+      continue;
+
+    chord = Chord();
+    chord.holdTime = holdTime;
+    chord.tolerance = tolerance;
+    chord.suppress = suppress;
+    chord.mask = buttons;
+    return c;
+  }
+  return -1;
+}
+
+void ButtonsClass::removeChord(byte chordId)
+{
+  if (chordId >= BUTTONS_MAX_CHORDS)
+    return;
+
+  _chords[chordId] = Chord();
+}
+
+boolean ButtonsClass::chordTransition(EventType type, ButtonIndex buttonId, unsigned long time)
+{
+  const ButtonMask bit = (ButtonMask)1 << buttonId;
+
+  if (type == EVENT_RELEASE) {
+    _downMask &= ~bit;
+
+    for (byte c = 0; c < BUTTONS_MAX_CHORDS; c++) {
+      Chord& chord = _chords[c];
+      if (!(chord.mask & bit))
+        continue;
+
+      if (chord.state == CHORD_FIRED)
+        postEvent(EVENT_CHORD_END, c, time);
+      cancelTimer(TIMER_CHORD, c);
+      chord.state = CHORD_IDLE;
+    }
+
+    if (_deferredMask & bit) {
+      // Released before any chord formed, so it was an ordinary press after all.
+      releaseDeferredPress(buttonId);
+      return true;
+    }
+    if (_claimedMask & bit) {
+      _claimedMask &= ~bit;
+      return false;
+    }
+    return true;
+  }
+
+  const ButtonMask wasDown = _downMask;
+  _downMask |= bit;
+
+  boolean defer = false;
+  unsigned long deferUntil = time;
+  for (byte c = 0; c < BUTTONS_MAX_CHORDS; c++) {
+    Chord& chord = _chords[c];
+    if (!(chord.mask & bit))
+      continue;
+
+    if (!(wasDown & chord.mask))
+      chord.startTime = time;
+
+    // Beyond the tolerance, this chord can no longer form until its buttons are all released.
+    if (chord.state != CHORD_IDLE || time - chord.startTime > chord.tolerance)
+      continue;
+
+    if ((_downMask & chord.mask) == chord.mask) {
+      chord.state = CHORD_COMPLETE;
+      if (chord.suppress) {
+        // Swallow everything the buttons of this chord do until they are released,
+        // including any presses already being held back.
+        _claimedMask |= chord.mask;
+        _deferredMask &= ~chord.mask;
+      }
+      if (chord.holdTime == 0) {
+        chord.state = CHORD_FIRED;
+        postEvent(EVENT_CHORD, c, time);
+      } else {
+        setTimer(TIMER_CHORD, c, time + chord.holdTime);
+      }
+    } else if (chord.suppress) {
+      // This press might yet turn out to be part of the chord.
+      const unsigned long formBy = chord.startTime + chord.tolerance;
+      if (!defer || (long)(formBy - deferUntil) > 0)
+        deferUntil = formBy;
+      defer = true;
+    }
+  }
+
+  if (_claimedMask & bit)
+    return false;
+
+  if (defer) {
+    _deferredMask |= bit;
+    _buttonContext[buttonId].deferredPressTime = time;
+    setTimer(TIMER_CHORD_DEFER, buttonId, deferUntil);
+    return false;
+  }
+  return true;
+}
+
+void ButtonsClass::releaseDeferredPress(ButtonIndex buttonId)
+{
+  const ButtonMask bit = (ButtonMask)1 << buttonId;
+  if (!(_deferredMask & bit))
+    return;
+
+  _deferredMask &= ~bit;
+  cancelTimer(TIMER_CHORD_DEFER, buttonId);
+  deliverTransition(EVENT_PRESS, buttonId, _buttonContext[buttonId].deferredPressTime);
+}
+#endif
+
+#if BUTTONS_AUTO_REPEAT
+void ButtonsClass::enableAutoRepeat(ButtonIndex buttonId, boolean enabled)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return;
+
+  _buttonContext[buttonId].repeatEnabled = enabled;
+  if (!enabled)
+    cancelTimer(TIMER_REPEAT, buttonId);
+}
+
+void ButtonsClass::setAutoRepeatTiming(uint16_t delay, uint16_t interval, byte accelerateAfter, uint16_t minInterval)
+{
+  _repeatDelay = delay;
+  _repeatInterval = interval;
+  _repeatAccelerateAfter = accelerateAfter;
+  _repeatMinInterval = minInterval;
+}
+
+void ButtonsClass::autoRepeat(ButtonIndex buttonId, unsigned long when)
+{
+  ButtonContext& context = _buttonContext[buttonId];
+
+  postEvent(EVENT_REPEAT, buttonId, when);
+
+  // Feed the repeat into the polled interface as if it were another press.
+  noInterrupts();
+  setChanged(buttonId);
+  if (_buttonStatus[buttonId].presses != (ClickCount)~(ClickCount)0)
+    _buttonStatus[buttonId].presses++;
+  interrupts();
+
+  if (context.repeatCount != UINT8_MAX)
+    context.repeatCount++;
+  if (_repeatAccelerateAfter != 0 && context.repeatCount % _repeatAccelerateAfter == 0) {
+    context.repeatInterval /= 2;
+    if (context.repeatInterval < _repeatMinInterval)
+      context.repeatInterval = _repeatMinInterval;
+  }
+
+  // Schedule from the deadline so repeats don't drift, unless update() has fallen so far
+  // behind that doing so would produce a burst of catch-up repeats.
+  unsigned long next = when + context.repeatInterval;
+  const unsigned long now = millis();
+  if ((long)(now - next) > 0)
+    next = now + context.repeatInterval;
+  setTimer(TIMER_REPEAT, buttonId, next);
+}
+#endif
+
+#if BUTTONS_MAX_SEQUENCES
+int8_t ButtonsClass::addSequence(const ButtonIndex* const buttonIds, byte length)
+{
+  if (nullptr == buttonIds || length == 0 || length > BUTTONS_MAX_SEQUENCE_LENGTH)
+    return -1;
+
+  for (byte q = 0; q < BUTTONS_MAX_SEQUENCES; q++) {
+    if (_sequenceLengths[q] != 0)
+      continue;
+
+    for (byte i = 0; i < length; i++) {
+      _sequences[q][i] = buttonIds[i];
+    }
+    _sequenceLengths[q] = length;
+
+    if (!compileSequences()) {
+      // Doesn't fit; put things back as they were.
+      _sequenceLengths[q] = 0;
+      compileSequences();
+      return -1;
+    }
+    return q;
+  }
+  return -1;
+}
+
+void ButtonsClass::removeSequence(byte sequenceId)
+{
+  if (sequenceId >= BUTTONS_MAX_SEQUENCES)
+    return;
+
+  _sequenceLengths[sequenceId] = 0;
+  compileSequences();
+}
+
+void ButtonsClass::setSequenceTimeout(uint16_t timeout)
+{
+  _sequenceTimeout = timeout;
+}
+
+boolean ButtonsClass::compileSequences()
+{
+  // Any partial match in progress is meaningless against a new automaton.
+  _sequenceState = 0;
+  _sequenceSymbols = 0;
+  for (byte state = 0; state < BUTTONS_SEQUENCE_STATES; state++) {
+    _sequenceMatches[state] = 0;
+    for (byte symbol = 0; symbol < BUTTONS_SEQUENCE_BUTTONS; symbol++) {
+      _sequenceNext[state][symbol] = SEQUENCE_NONE;
+    }
+  }
+
+  // Build a trie of all the sequences, assigning input symbols to buttons as we go.
+  byte states = 1;
+  for (byte q = 0; q < BUTTONS_MAX_SEQUENCES; q++) {
+    byte state = 0;
+    for (byte i = 0; i < _sequenceLengths[q]; i++) {
+      byte symbol = 0;
+      while (symbol < _sequenceSymbols && _sequenceButtons[symbol] != _sequences[q][i]) {
+        symbol++;
+      }
+      if (symbol == _sequenceSymbols) {
+        if (_sequenceSymbols == BUTTONS_SEQUENCE_BUTTONS)
+          return false;
+        _sequenceButtons[_sequenceSymbols++] = _sequences[q][i];
+      }
+
+      if (_sequenceNext[state][symbol] == SEQUENCE_NONE) {
+        if (states == BUTTONS_SEQUENCE_STATES)
+          return false;
+        _sequenceNext[state][symbol] = states++;
+      }
+      state = _sequenceNext[state][symbol];
+    }
+    if (_sequenceLengths[q] != 0)
+      _sequenceMatches[state] |= (uint16_t)1 << q;
+  }
+
+  // Work through the trie breadth first, so that each state's failure state (the longest
+  // proper suffix of its input that is also a trie prefix) is complete before it is needed.
+  // Missing transitions are filled in from the failure state, and matches are inherited from it.
+  byte queue[BUTTONS_SEQUENCE_STATES];
+  byte failure[BUTTONS_SEQUENCE_STATES];
+  byte head = 0;
+  byte tail = 0;
+
+  for (byte symbol = 0; symbol < _sequenceSymbols; symbol++) {
+    const byte child = _sequenceNext[0][symbol];
+    if (child == SEQUENCE_NONE) {
+      _sequenceNext[0][symbol] = 0;
+    } else {
+      failure[child] = 0;
+      queue[tail++] = child;
+    }
+  }
+
+  while (head != tail) {
+    const byte state = queue[head++];
+    for (byte symbol = 0; symbol < _sequenceSymbols; symbol++) {
+      const byte child = _sequenceNext[state][symbol];
+      if (child == SEQUENCE_NONE) {
+        _sequenceNext[state][symbol] = _sequenceNext[failure[state]][symbol];
+      } else {
+        failure[child] = _sequenceNext[failure[state]][symbol];
+        _sequenceMatches[child] |= _sequenceMatches[failure[child]];
+        queue[tail++] = child;
+      }
+    }
+  }
+
+  return true;
+}
+
+void ButtonsClass::sequenceInput(ButtonIndex buttonId, unsigned long time)
+{
+  // Too long since the last press, so start again.
+  if (time - _sequenceLastPress > _sequenceTimeout)
+    _sequenceState = 0;
+  _sequenceLastPress = time;
+
+  byte symbol = 0;
+  while (symbol < _sequenceSymbols && _sequenceButtons[symbol] != buttonId) {
+    symbol++;
+  }
+  if (symbol == _sequenceSymbols) {
+    // A button that isn't in any sequence breaks whatever was in progress.
+    _sequenceState = 0;
+    return;
+  }
+
+  _sequenceState = _sequenceNext[_sequenceState][symbol];
+
+  uint16_t matches = _sequenceMatches[_sequenceState];
+  for (byte q = 0; matches != 0; q++, matches >>= 1) {
+    if (matches & 1)
+      postEvent(EVENT_SEQUENCE, q, time);
+  }
+}
+#endif
+
+#if BUTTONS_STATISTICS
+boolean ButtonsClass::statistics(ButtonIndex buttonId, Statistics& stats)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return false;
+
+  // The counters are multi-byte, so take the copy with the ISR held off to avoid tearing.
+  noInterrupts();
+  stats.transitions = _buttonStatus[buttonId].stats.transitions;
+  stats.bounces = _buttonStatus[buttonId].stats.bounces;
+  stats.maxBounceBurst = _buttonStatus[buttonId].stats.maxBounceBurst;
+  stats.maxBounceDuration = _buttonStatus[buttonId].stats.maxBounceDuration;
+  interrupts();
+  return true;
+}
+
+void ButtonsClass::resetStatistics()
+{
+  if (!_begun)
+    return;
+
+  for (ButtonIndex i = 0; i < _numberOfButtons; i++) {
+    resetStatistics(i);
+  }
+}
+
+void ButtonsClass::resetStatistics(ButtonIndex buttonId)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return;
+
+  noInterrupts();
+  _buttonStatus[buttonId].stats.transitions = 0;
+  _buttonStatus[buttonId].stats.bounces = 0;
+  _buttonStatus[buttonId].stats.maxBounceBurst = 0;
+  _buttonStatus[buttonId].stats.maxBounceDuration = 0;
+  interrupts();
+}
+#endif
+
+#if BUTTONS_ISR_PROFILING
+void ButtonsClass::isrProfile(IsrProfile& profile)
+{
+  noInterrupts();
+  const uint64_t total = _isrTotalTime;
+  profile.invocations = _isrInvocations;
+  profile.minTime = (_isrInvocations > 0) ? _isrMinTime : 0;
+  profile.maxTime = _isrMaxTime;
+  profile.peakRate = _isrPeakRate;
+  interrupts();
+
+  // Do the 64 bit division outside of the critical section.
+  profile.avgTime = (profile.invocations > 0) ? (uint32_t)(total / profile.invocations) : 0;
+}
+
+void ButtonsClass::resetIsrProfile()
+{
+  noInterrupts();
+  _isrInvocations = 0;
+  _isrMinTime = UINT32_MAX;
+  _isrMaxTime = 0;
+  _isrTotalTime = 0;
+  _isrPeakRate = 0;
+  for (byte i = 0; i < ISR_RATE_SLOTS; i++) {
+    _isrRateSlots[i] = 0;
+  }
+  interrupts();
+}
+
+void ButtonsClass::printIsrProfile(Print& out)
+{
+  IsrProfile profile;
+  isrProfile(profile);
+
+  const char* const units = profileUnitsAreCycles() ? "cyc" : "us";
+  out.print("isr n=");
+  out.print((unsigned long)profile.invocations);
+  out.print(" min=");
+  out.print((unsigned long)profile.minTime);
+  out.print(" avg=");
+  out.print((unsigned long)profile.avgTime);
+  out.print(" max=");
+  out.print((unsigned long)profile.maxTime);
+  out.print(units);
+  out.print(" peak=");
+  out.print((unsigned int)profile.peakRate);
+  out.print("/");
+  out.print((unsigned long)BUTTONS_ISR_RATE_WINDOW);
+  out.println("ms");
+}
+#endif
+
+#if BUTTONS_LATENCY_TRACKING
+void ButtonsClass::consumeTransition(ButtonIndex buttonId)
+{
+  noInterrupts();
+  const boolean pending = _buttonStatus[buttonId].latencyPending;
+  const unsigned long acceptedAt = _buttonStatus[buttonId].acceptedAt;
+  _buttonStatus[buttonId].latencyPending = false;
+  interrupts();
+
+  if (!pending)
+    return;
+
+  // Bucket index is the position of the highest set bit of the delay.
+  unsigned long latency = micros() - acceptedAt;
+  byte bucket = 0;
+  while (latency > 1 && bucket < LATENCY_BUCKETS - 1) {
+    latency >>= 1;
+    bucket++;
+  }
+
+  uint16_t& count = _latency[buttonId].buckets[bucket];
+  if (count != UINT16_MAX)
+    count++;
+}
+
+unsigned long ButtonsClass::latencyPercentile(ButtonIndex buttonId, byte percent)
+{
+  const unsigned long samples = latencySamples(buttonId);
+  if (samples == 0)
+    return 0;
+  if (percent > 100)
+    percent = 100;
+
+  // Smallest number of samples that covers the requested percentage, rounding up.
+  const unsigned long target = (samples * percent + 99) / 100;
+  unsigned long seen = 0;
+  for (byte bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    seen += _latency[buttonId].buckets[bucket];
+    if (seen >= target && seen > 0)
+      return (bucket == LATENCY_BUCKETS - 1) ? ULONG_MAX : (2UL << bucket) - 1;
+  }
+  return ULONG_MAX;
+}
+
+unsigned long ButtonsClass::latencySamples(ButtonIndex buttonId)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return 0;
+
+  unsigned long samples = 0;
+  for (byte bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    samples += _latency[buttonId].buckets[bucket];
+  }
+  return samples;
+}
+
+void ButtonsClass::resetLatency()
+{
+  if (!_begun)
+    return;
+
+  for (ButtonIndex i = 0; i < _numberOfButtons; i++) {
+    resetLatency(i);
+  }
+}
+
+void ButtonsClass::resetLatency(ButtonIndex buttonId)
+{
+  if (!_begun || buttonId >= _numberOfButtons)
+    return;
+
+  _latency[buttonId] = LatencyHistogram();
 }
+#endif
 
 ButtonsClass Buttons;
@@ -24,6 +24,17 @@
 #define BUTTONS_CLASS_H
 
 #include <Arduino.h>
+#include "ButtonsConfig.h"
+#include "ButtonsQueue.h"
+#include "ButtonsTimerWheel.h"
+#include "ButtonsChangeSet.h"
+
+// Cortex-M3 and above have a DWT cycle counter, which gives far better resolution than micros().
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+#define BUTTONS_HAS_CYCLE_COUNTER 1
+#else
+#define BUTTONS_HAS_CYCLE_COUNTER 0
+#endif
 
 /**
  * This static-only class implements a system for getting user input from buttons.
@@ -48,18 +59,62 @@ class ButtonsClass final
 {
   public:
 
+    /**
+     * Type of button IDs, set by BUTTONS_INDEX_TYPE in ButtonsConfig.h.
+     * With the default of uint8_t up to 255 buttons can be managed, and with uint16_t up to 65535.
+     */
+    typedef BUTTONS_INDEX_TYPE ButtonIndex;
+
+    static_assert((ButtonIndex)-1 > 0 && sizeof(ButtonIndex) <= 2,
+                  "BUTTONS_INDEX_TYPE must be uint8_t or uint16_t");
+
+    /**
+     * Value that is never a valid button ID, returned by addButton() and nextChanged()
+     * when there is no button to return.
+     */
+    static const ButtonIndex NO_BUTTON = (ButtonIndex)~(ButtonIndex)0;
+
     /**
      * Initialize the buttons as attached to the specified pins and attach appropriate interrupts.
      * The index of each button in the buttonPins parameter array is preserved for the buttonId parameter
      * on accessor methods such as clicked, down etc. Hence, if you want to read the status of
      * the button attached to the pin specified in buttonPins[3], you could call clicked(3).
+     * This returns straight away. Each button starts in the state its pin is actually in, so one
+     * held down from power-up reads as down, and for the first PULLUP_SETTLE_TIME milliseconds
+     * changes are followed but not reported, while the pullups settle.
      *
      * @param buttonPins        pointer to an array of bytes, each being the number of a
      *                          pin with a button attached that is to be managed by this object.
      * @param numberOfButtons   Number of buttons and size of the buttonPins array
      * @return                  true on success, false on failure.
      */
-    boolean begin(const byte* const buttonPins, byte numberOfButtons);
+    boolean begin(const byte* const buttonPins, ButtonIndex numberOfButtons);
+
+    template <ButtonIndex N> class Storage;
+
+    /**
+     * As begin() above, but keeps all per-button state in the storage provided rather than
+     * allocating it from the heap, so that the library never uses the heap at all.
+     * The storage must outlive the call to end(), and holds up to N buttons, so addButton()
+     * can add buttons up to that number and fails beyond it.
+     * Each button takes BYTES_PER_BUTTON bytes, so sizeof(Storage<N>) is N times that, plus
+     * the Change Flag bitmap of about N / 8 bytes and a few bytes of padding on platforms
+     * that align data (none on AVR).
+     *
+     * @param buttonPins        pointer to an array of bytes, each being the number of a
+     *                          pin with a button attached that is to be managed by this object.
+     * @param numberOfButtons   Number of buttons and size of the buttonPins array, no more than N.
+     * @param storage           Storage for the buttons, normally a global ButtonStorage<N>.
+     * @return                  true on success, false on failure.
+     */
+    template <ButtonIndex N>
+    boolean begin(const byte* const buttonPins, ButtonIndex numberOfButtons, Storage<N>& storage)
+    {
+      if (numberOfButtons > N)
+        return false;
+
+      return start(buttonPins, numberOfButtons, N, storage.arrays(), false);
+    }
 
     /**
      * TO DO
@@ -81,7 +136,7 @@ class ButtonsClass final
      * @return                  true if the button has been clicked since the Change Flag
      *                          was last cleared, false otherwise.
      */
-    boolean clicked(byte buttonId);
+    boolean clicked(ButtonIndex buttonId);
     
     /**
      * Returns a boolean value indicating if the user has "released" the button,
@@ -91,7 +146,7 @@ class ButtonsClass final
      * @return                  true if the button has been clicked since the Change Flag
      *                          was last cleared, false otherwise.
      */
-    boolean released(byte buttonId);
+    boolean released(ButtonIndex buttonId);
     
     /**
      * Returns a boolean value indicating if the button is currently "down"/"pressed".
@@ -101,7 +156,7 @@ class ButtonsClass final
      * @param buttonId          Index of the button whose status is to be checked.
      * @return                  true if the button is down.
      */
-    boolean down(byte buttonId);
+    boolean down(ButtonIndex buttonId);
 
     /**
      * Returns a boolean value indicating if the button is currently "up"/"not pressed".
@@ -111,7 +166,7 @@ class ButtonsClass final
      * @param buttonId          Index of the button whose status is to be checked.
      * @return                  true if the button is up.
      */
-    boolean up(byte buttonId);
+    boolean up(ButtonIndex buttonId);
 
     /**
      * Returns a boolean value indicating if the button's state has changed since the 
@@ -122,7 +177,58 @@ class ButtonsClass final
      * @param buttonId          Index of the button whose status is to be checked.
      * @return                  true if the button's state has changed.
      */
-    boolean changed(byte buttonId);
+    boolean changed(ButtonIndex buttonId);
+
+#if BUTTONS_FAST_QUERIES
+    /**
+     * As down(), but for use in tight loops. This and the other fast queries below are inline,
+     * and read a copy of the state of buttons 0 to BUTTONS_FAST_QUERIES - 1 that the ISR keeps
+     * in bitmaps at fixed addresses, so with a constant buttonId each is a load and a bit test
+     * or two. Nothing is checked unless BUTTONS_DEBUG is set, so buttonId must be in range and
+     * the object started. fastClicked() and fastReleased() do not record latency for
+     * BUTTONS_LATENCY_TRACKING.
+     *
+     * @param buttonId          Index of the button whose status is to be checked,
+     *                          less than BUTTONS_FAST_QUERIES.
+     * @return                  true if the button is down.
+     */
+    static inline boolean fastDown(ButtonIndex buttonId)
+    {
+      return fastCheck(buttonId) && fastBit(_fastDown, buttonId);
+    }
+
+    /**
+     * Inline up() for buttons 0 to BUTTONS_FAST_QUERIES - 1; see fastDown().
+     */
+    static inline boolean fastUp(ButtonIndex buttonId)
+    {
+      return fastCheck(buttonId) && !fastBit(_fastDown, buttonId);
+    }
+
+    /**
+     * Inline changed() for buttons 0 to BUTTONS_FAST_QUERIES - 1; see fastDown().
+     */
+    static inline boolean fastChanged(ButtonIndex buttonId)
+    {
+      return fastCheck(buttonId) && fastBit(_fastChanged, buttonId);
+    }
+
+    /**
+     * Inline clicked() for buttons 0 to BUTTONS_FAST_QUERIES - 1; see fastDown().
+     */
+    static inline boolean fastClicked(ButtonIndex buttonId)
+    {
+      return fastCheck(buttonId) && fastBit(_fastChanged, buttonId) && fastBit(_fastDown, buttonId);
+    }
+
+    /**
+     * Inline released() for buttons 0 to BUTTONS_FAST_QUERIES - 1; see fastDown().
+     */
+    static inline boolean fastReleased(ButtonIndex buttonId)
+    {
+      return fastCheck(buttonId) && fastBit(_fastChanged, buttonId) && !fastBit(_fastDown, buttonId);
+    }
+#endif
 
     /**
      * This method clears all Change Flags for all buttons.
@@ -136,93 +242,1860 @@ class ButtonsClass final
      * 
      * @param buttonId          Index of the button whose change flag is to be cleared.
      */
-    void clearChangeFlag(byte buttonId);
+    void clearChangeFlag(ButtonIndex buttonId);
 
     /**
-     * Returns the number of buttons currently controlled by this class.
+     * Finds the next button whose Change Flag is set, without looking at the buttons that
+     * have not changed, so that with many buttons only those that changed cost anything:
      *
-     * @return    The number of buttons controlled by this class
+     *   for (ButtonIndex i = Buttons.nextChanged(0); i != Buttons.NO_BUTTON; i = Buttons.nextChanged(i + 1))
+     *
+     * @param from              ID of the first button to consider.
+     * @return                  ID of the first button at or after from whose Change Flag is set,
+     *                          or NO_BUTTON if there is none.
      */
-    byte numberOfButtons();
+    ButtonIndex nextChanged(size_t from);
 
-    //This class is a singleton so copying it around will have no effect
-    //and the default constructor will do as there's nothing to construct.
-    ButtonsClass() = default;
-    ~ButtonsClass() = default;
-    ButtonsClass& operator=(const ButtonsClass&) = default;
-    ButtonsClass(const ButtonsClass&) = default;
+    /**
+     * Type of function called back with a button and its state.
+     *
+     * @param buttonId          ID of the button.
+     * @param down              true if the button is down, false if it is up.
+     * @param context           Pointer given along with the callback, for it to use as it likes.
+     */
+    typedef void (*ButtonCallback)(ButtonIndex buttonId, boolean down, void* context);
 
-  private:
+    /**
+     * Changes of state that a callback can be registered for, which may be combined.
+     */
+    enum CallbackTrigger : byte
+    {
+      ON_PRESS = 0x01,
+      ON_RELEASE = 0x02,
+      ON_CHANGE = ON_PRESS | ON_RELEASE
+    };
 
     /**
-     * Debounce period in milliseconds.
+     * Calls back for each button whose Change Flag is set, in order of ID, clearing the flag
+     * as it goes. Each flag is cleared together with reading the state passed to the callback,
+     * so a change that happens during the walk is never lost, only left for the next one.
+     * Only the buttons that have changed are looked at, so when none have this is a single
+     * comparison.
+     *
+     * @param callback          Function to call for each changed button.
+     * @param context           Passed to the callback.
      */
-    static const unsigned long DEBOUNCE_DELAY = 50;
+    void forEachChanged(ButtonCallback callback, void* context = nullptr);
 
     /**
-     * This structure encompasses information relating to an individual button.
+     * A consistent snapshot of the state of a single button, as returned by stateInfo().
      */
-    struct Button
+    struct StateInfo
     {
       /**
-       * Stores the most recently measured state of the button.
-       * true = pushed, false = not pushed.
+       * true if the button is down, false if it is up.
        */
-      boolean currentState;
+      boolean down;
 
       /**
-       * This flag indicates is set to true when currentState changes,
-       * and (optionally) set false when that state is read.
+       * true if the Change Flag is set.
        */
-      boolean changeFlag;
+      boolean changed;
 
       /**
-       * This records the last time that an Interrupt was triggered from this pin.
-       * Used as part of the debounce routine.
+       * Value of millis() when the button last changed state, or last bounced.
        */
       unsigned long lastChangeTime;
 
       /**
-       * Constructor for objects of Button.
+       * Milliseconds since the button last changed state, up to MAX_ELAPSED.
        */
-      Button() :
-        currentState(false),
-        changeFlag(false),
-        lastChangeTime(0)
-      { }
+      unsigned long idleFor;
+
+      /**
+       * Milliseconds the button has been held down for, or 0 if it is up.
+       */
+      unsigned long heldFor;
     };
 
     /**
-     * This function is called whenever a button interrupt is fired.
-     * It reads all the button states and updates their _buttonStatus objects
-     * accordingly.
+     * Reads the state, Change Flag and last change time of a button all together, so that
+     * they always agree with one another. On AVR a four-byte time can be torn by the ISR
+     * part way through reading it, and rather than holding the ISR off to prevent that,
+     * this reads again if the ISR has updated the button in the meantime. The Change Flag
+     * is left as it is.
+     * Must not be called from an interrupt handler.
+     *
+     * @param buttonId          Index of the button whose state is to be read.
+     * @return                  The state of the button, or all zeroes if the object has not
+     *                          been started or buttonId is out of range.
      */
-    static void button_ISR();
+    StateInfo stateInfo(ButtonIndex buttonId);
 
     /**
-     * Stores the number of buttons controlled by this class,
-     * which is also the size of the _buttonPins and _buttonStatus arrays.
+     * Longest time that heldFor() and idleFor() can measure; longer times read as this.
+     * Unless BUTTONS_TIMESTAMP_BITS is less than 32, this is the whole range of millis().
      */
-    static byte _numberOfButtons;
+    static const unsigned long MAX_ELAPSED = (BUTTONS_TIMESTAMP_BITS == 32) ? ~0UL
+        : ((unsigned long)1 << (BUTTONS_TIMESTAMP_BITS - 1)) * BUTTONS_TIMESTAMP_TICK;
 
     /**
-     * This array stores pin numbers for each button controlled by this class.
+     * Returns how long a button has been held down for, so that a sketch need not time it itself.
+     * Like the other times here, this is measured from the last edge on the pin, so it
+     * can be late by as long as the contacts bounced for.
+     *
+     * @param buttonId          Index of the button.
+     * @return                  Milliseconds since the button went down, or 0 if it is up.
      */
-    static byte* _buttonPins;
+    unsigned long heldFor(ButtonIndex buttonId);
 
     /**
-     * This array stores Button objects for each button controlled by this class,
-     * each containing relevant information for the servicing of the ISR.
-     * Its volatile because its members may be modified by an ISR, so we need to
-     * prevent register caching of member values.
+     * Returns how long it has been since a button last changed state, whichever way it went.
+     *
+     * @param buttonId          Index of the button.
+     * @return                  Milliseconds since the button last changed, or 0 if the object
+     *                          has not been started or buttonId is out of range.
      */
-    static volatile Button* _buttonStatus;
+    unsigned long idleFor(ButtonIndex buttonId);
 
     /**
-     * Set to true if this class has been initialised, false otherwise.
+     * Returns the value of millis() when a button last changed state.
+     *
+     * @param buttonId          Index of the button.
+     * @return                  Time of the last change, or 0 if the object has not been
+     *                          started or buttonId is out of range.
      */
-    static boolean _begun;
-};
+    unsigned long lastChangeAt(ButtonIndex buttonId);
+
+    /**
+     * Returns the value of millis() when any button last changed state, or when begin() was
+     * called if none has since. This is kept up to date by the ISR as it goes, so an inactivity
+     * timeout need only compare it with millis(), however many buttons there are.
+     *
+     * @return                  Time of the last change of any button.
+     */
+    unsigned long lastActivity();
+
+    /**
+     * Returns the number of buttons currently controlled by this class.
+     * Buttons removed with removeButton() leave a gap that is still counted, so this is
+     * always one more than the highest button ID in use.
+     *
+     * @return    The number of buttons controlled by this class
+     */
+    ButtonIndex numberOfButtons();
+
+    /**
+     * Adds a button on the specified pin without stopping the others.
+     * The new button takes the ID of the first button removed with removeButton(), if there
+     * is one, and otherwise the next ID after the highest in use. The IDs of other buttons
+     * do not change. The new button starts enabled, in the state its pin is in, and for the
+     * first PULLUP_SETTLE_TIME milliseconds its changes are followed but not reported, while
+     * its pullup settles. The other buttons carry on reporting changes throughout.
+     *
+     * @param pin               Number of the pin the button is attached to.
+     * @return                  ID of the new button, or NO_BUTTON if begin() has not been called,
+     *                          there are already as many buttons as ButtonIndex allows or
+     *                          memory ran out.
+     */
+    ButtonIndex addButton(byte pin);
+
+    /**
+     * Stops managing the specified button and detaches its interrupt.
+     * Its ID may be reused by a later addButton(); the IDs of other buttons do not change.
+     *
+     * @param buttonId          ID of the button to remove.
+     */
+    void removeButton(ButtonIndex buttonId);
+
+    /**
+     * Enables or disables the specified button. A disabled button is ignored by the ISR, so its
+     * state, Change Flag and counts do not change, and anything it had in progress, such as a
+     * gesture or auto-repeat, is abandoned. On being enabled again it takes up the state its
+     * pin is then in, without reporting a change.
+     * Buttons are enabled by begin() and addButton().
+     *
+     * @param buttonId          ID of the button.
+     * @param enabled           true to enable the button, false to disable it.
+     */
+    void setEnabled(ButtonIndex buttonId, boolean enabled);
+
+    /**
+     * Returns true if the specified button exists and is enabled.
+     *
+     * @param buttonId          ID of the button.
+     */
+    boolean enabled(ButtonIndex buttonId);
+
+    /**
+     * Puts the processor to sleep until a button interrupt fires, update() next has work to do
+     * (see nextDeadline()), or the timeout passes, whichever comes first.
+     * On AVR this uses idle sleep, the deepest mode in which CHANGE interrupts still wake the
+     * processor, and in which millis() keeps counting. On ARM it waits for interrupt. Elsewhere
+     * it simply yields until one of the conditions is met.
+     * Other interrupts, such as the millis() tick, wake the processor briefly but this does not
+     * return until one of the conditions above is met.
+     *
+     * @param timeout           Longest time to sleep, in milliseconds, or 0 for no limit.
+     * @return                  true if woken by a button interrupt, false otherwise.
+     */
+    boolean sleepUntilEvent(unsigned long timeout = 0);
+
+    /**
+     * Integer type of press and release counts. See BUTTONS_CLICK_COUNT_TYPE.
+     */
+    typedef BUTTONS_CLICK_COUNT_TYPE ClickCount;
+
+    /**
+     * Returns the number of times the button has been pressed since its count was
+     * last taken with takeClickCount(). Unlike the Change Flag, this does not lose
+     * presses that happen in quick succession between two polls.
+     * The count saturates rather than wrapping.
+     *
+     * @param buttonId          Index of the button whose press count is to be read.
+     * @return                  Number of presses counted.
+     */
+    ClickCount clickCount(ButtonIndex buttonId);
+
+    /**
+     * Returns the number of times the button has been pressed since its count was
+     * last taken, and atomically resets the count to zero.
+     *
+     * @param buttonId          Index of the button whose press count is to be taken.
+     * @return                  Number of presses counted.
+     */
+    ClickCount takeClickCount(ButtonIndex buttonId);
+
+    /**
+     * Returns the number of times the button has been released since its count was
+     * last taken with takeReleaseCount().
+     * The count saturates rather than wrapping.
+     *
+     * @param buttonId          Index of the button whose release count is to be read.
+     * @return                  Number of releases counted.
+     */
+    ClickCount releaseCount(ButtonIndex buttonId);
+
+    /**
+     * Returns the number of times the button has been released since its count was
+     * last taken, and atomically resets the count to zero.
+     *
+     * @param buttonId          Index of the button whose release count is to be taken.
+     * @return                  Number of releases counted.
+     */
+    ClickCount takeReleaseCount(ButtonIndex buttonId);
+
+#if BUTTONS_HAS_UPDATE
+    /**
+     * Processes transitions queued by the ISR and any timing deadlines that have come due,
+     * turning them into events for readEvent(). With compact times, see BUTTONS_TIMESTAMP_BITS,
+     * it also stops the times of idle buttons from wrapping round.
+     * This should be called from the main loop. When nothing has happened since the last
+     * call it returns almost immediately, so it is cheap to call on every iteration.
+     */
+    void update();
+
+    /**
+     * Finds when update() next has work to do: the earliest pending gesture, auto-repeat,
+     * chord, debounce or compact time deadline, or now if the ISR has queued anything.
+     * Use this to sleep, or to skip calling update(), until then.
+     *
+     * @param deadline          Receives the value of millis() by which update() should next be called.
+     * @return                  true if there is anything pending, false if update() has nothing
+     *                          to do until the next button interrupt.
+     */
+    boolean nextDeadline(unsigned long& deadline);
+#endif
+
+#if BUTTONS_EVENT_QUEUE_SIZE
+    /**
+     * Kinds of event reported through readEvent().
+     */
+    enum EventType : byte
+    {
+      EVENT_PRESS,          // Button went down.
+      EVENT_RELEASE,        // Button went up.
+      EVENT_CLICK,          // Gesture: one short press.
+      EVENT_DOUBLE_CLICK,   // Gesture: two short presses in quick succession.
+      EVENT_TRIPLE_CLICK,   // Gesture: three short presses in quick succession.
+      EVENT_LONG_PRESS,     // Gesture: press released after the long press time but before the hold time.
+      EVENT_HOLD_START,     // Gesture: button still down at the hold time.
+      EVENT_HOLD_END,       // Gesture: button released after a hold started.
+      EVENT_CHORD,          // Chord: all of its buttons are down and have been held for its hold time.
+      EVENT_CHORD_END,      // Chord: one of its buttons was released after EVENT_CHORD.
+      EVENT_SEQUENCE,       // Sequence: the last press of a registered sequence was made.
+      EVENT_REPEAT,         // Auto-repeat: button is still held.
+      EVENT_QUARANTINE,     // Storm protection: button's interrupt detached, now being polled.
+      EVENT_QUARANTINE_END, // Storm protection: button's pin has gone quiet, interrupt restored.
+      EVENT_EDGE_CONFIRMED, // Raw edges: the last edge passed to the raw edge callback was real.
+      EVENT_EDGE_CANCELLED  // Raw edges: the last edge passed to the raw edge callback was a glitch.
+    };
+
+    /**
+     * A single event reported through readEvent().
+     */
+    struct Event
+    {
+      /**
+       * What happened.
+       */
+      EventType type;
+
+      /**
+       * Index of the button it happened to.
+       * For chord events, this is instead the chord index returned by addChord(),
+       * and for sequence events the sequence index returned by addSequence().
+       */
+      ButtonIndex buttonId;
+
+      /**
+       * Value of millis() at which it happened. For presses and releases this is the
+       * time the ISR accepted the transition, not the time update() processed it.
+       */
+      unsigned long time;
+    };
+
+
+    /**
+     * Removes the oldest event from the event queue.
+     * Call update() first so that the queue is up to date.
+     *
+     * @param event             Receives the event.
+     * @return                  true if an event was read, false if the queue was empty.
+     */
+    boolean readEvent(Event& event);
+
+    /**
+     * Returns the number of events that have been dropped because a queue was full,
+     * either because update() was not called often enough or because readEvent() was not.
+     *
+     * @return                  The number of events dropped. Saturates.
+     */
+    uint16_t droppedEvents();
+
+#endif
+
+#if BUTTONS_GESTURES
+    /**
+     * Sets the timings used by the gesture recogniser. See BUTTONS_LONG_PRESS_TIME etc.
+     * Gestures already in progress may be recognised with a mix of the old and new timings.
+     *
+     * @param longPressTime     Minimum time a press must be held to be a long press, in milliseconds.
+     * @param holdTime          Time after which a press becomes a hold, in milliseconds.
+     * @param multiClickWindow  Maximum time from a release to the next press for a double
+     *                          or triple click, in milliseconds.
+     */
+    void setGestureTiming(uint16_t longPressTime, uint16_t holdTime, uint16_t multiClickWindow);
+
+    /**
+     * Enables or disables gesture recognition on the specified button.
+     * Gestures are enabled on every button by begin(). Presses and releases are reported
+     * either way.
+     *
+     * @param buttonId          Index of the button.
+     * @param enabled           true to recognise gestures on this button, false not to.
+     */
+    void enableGestures(ButtonIndex buttonId, boolean enabled);
+#endif
+
+#if BUTTONS_MAX_CHORDS || BUTTONS_MAX_CALLBACKS
+    /**
+     * A set of buttons, one bit per button, with button 0 as the least significant bit.
+     * Only buttons 0 to 31 can be represented.
+     */
+    typedef uint32_t ButtonMask;
+#endif
+
+#if BUTTONS_MAX_CHORDS
+
+    /**
+     * Registers a chord: a combination of buttons that are pressed together.
+     * The chord is recognised when all of its buttons go down within the tolerance
+     * of the first of them, and EVENT_CHORD is reported once they have all been held
+     * for the hold time. EVENT_CHORD_END follows when any of them is released.
+     *
+     * If suppress is set, presses of the chord's buttons are held back for up to the
+     * tolerance while the chord might still form, and are discarded, together with their
+     * releases and gestures, if it does. They are reported late, with their original
+     * time, if it does not.
+     *
+     * @param buttons           Mask of the buttons making up the chord.
+     * @param holdTime          Time all the buttons must be held down for, in milliseconds.
+     * @param tolerance         Time within which all the buttons must be pressed, in milliseconds.
+     * @param suppress          true to hide the individual button events of the chord.
+     * @return                  The chord index, used in chord events, or -1 if there is
+     *                          no room for another chord or buttons is empty.
+     */
+    int8_t addChord(ButtonMask buttons, uint16_t holdTime = 0,
+                    uint16_t tolerance = BUTTONS_CHORD_TOLERANCE, boolean suppress = true);
+
+    /**
+     * Unregisters a chord.
+     *
+     * @param chordId           The index returned by addChord().
+     */
+    void removeChord(byte chordId);
+#endif
+
+#if BUTTONS_MAX_SEQUENCES
+    /**
+     * Registers a sequence of button presses, such as a combination or passcode.
+     * EVENT_SEQUENCE is reported whenever the last press of the sequence is made, provided
+     * the presses before it were the rest of the sequence, in order, with no other presses
+     * in between and no more than the sequence timeout between any two of them.
+     * Sequences may overlap or be contained within one another; all of them are matched.
+     *
+     * All registered sequences are compiled into a single automaton here, so that
+     * recognising them costs the same for each press however many there are.
+     *
+     * @param buttonIds         Pointer to an array of button indices, in the order they must be pressed.
+     * @param length            Number of presses in the sequence.
+     * @return                  The sequence index, used in sequence events, or -1 if the sequence
+     *                          is empty or too long, or there is no room for it.
+     */
+    int8_t addSequence(const ButtonIndex* const buttonIds, byte length);
+
+    /**
+     * Unregisters a sequence.
+     *
+     * @param sequenceId        The index returned by addSequence().
+     */
+    void removeSequence(byte sequenceId);
+
+    /**
+     * Sets the longest time allowed between two presses of a sequence.
+     *
+     * @param timeout           The timeout, in milliseconds.
+     */
+    void setSequenceTimeout(uint16_t timeout);
+#endif
+
+#if BUTTONS_AUTO_REPEAT
+    /**
+     * Enables or disables auto-repeat on the specified button.
+     * While an auto-repeating button is held, EVENT_REPEAT is reported at intervals, and
+     * each repeat also sets the Change Flag and counts as a press for clickCount(), so
+     * that clicked() and click counts see repeats just as they see presses.
+     * Auto-repeat is disabled on every button by begin().
+     *
+     * @param buttonId          Index of the button.
+     * @param enabled           true to auto-repeat this button, false not to.
+     */
+    void enableAutoRepeat(ButtonIndex buttonId, boolean enabled);
+
+    /**
+     * Sets the auto-repeat timings shared by all buttons. See BUTTONS_REPEAT_DELAY etc.
+     *
+     * @param delay             Time from press to the first repeat, in milliseconds.
+     * @param interval          Time between the first repeats, in milliseconds.
+     * @param accelerateAfter   Number of repeats after which the interval is halved, or 0
+     *                          never to accelerate.
+     * @param minInterval       Shortest time between repeats, in milliseconds.
+     */
+    void setAutoRepeatTiming(uint16_t delay, uint16_t interval, byte accelerateAfter, uint16_t minInterval);
+#endif
+
+#if BUTTONS_MAX_CALLBACKS
+    /**
+     * Registers a callback to be made by dispatch() when the specified button is pressed.
+     *
+     * @param buttonId          Index of the button.
+     * @param callback          Function to call.
+     * @param context           Passed to the callback.
+     * @return                  The callback index, for removeCallback(), or -1 if there
+     *                          is no room for another callback.
+     */
+    int8_t onPress(ButtonIndex buttonId, ButtonCallback callback, void* context = nullptr);
+
+    /**
+     * As onPress(), but for when the button is released.
+     */
+    int8_t onRelease(ButtonIndex buttonId, ButtonCallback callback, void* context = nullptr);
+
+    /**
+     * As onPress(), but for when the button is either pressed or released.
+     */
+    int8_t onChange(ButtonIndex buttonId, ButtonCallback callback, void* context = nullptr);
+
+    /**
+     * Registers a callback to be made by dispatch() when any of a set of buttons changes
+     * state in the specified way. The callback is told which of them it was.
+     *
+     * @param buttons           Mask of the buttons.
+     * @param triggers          ON_PRESS, ON_RELEASE or ON_CHANGE.
+     * @param callback          Function to call.
+     * @param context           Passed to the callback.
+     * @return                  The callback index, for removeCallback(), or -1 if there
+     *                          is no room for another callback or buttons or triggers is empty.
+     */
+    int8_t addCallback(ButtonMask buttons, byte triggers, ButtonCallback callback, void* context = nullptr);
+
+    /**
+     * Unregisters a callback. This may be called from within a callback.
+     *
+     * @param callbackId        The index returned when the callback was registered.
+     */
+    void removeCallback(byte callbackId);
+
+    /**
+     * Makes the registered callbacks for every button that has changed state since the last
+     * call, and clears their Change Flags, in a single pass over the changed buttons only.
+     * Call this from the main loop; callbacks are never made from the ISR.
+     * Like clicked() and released(), this sees the state a button is in when it is called,
+     * so a button pressed and released again between two calls is reported only as released.
+     * Auto-repeats, if enabled, are reported as presses.
+     */
+    void dispatch();
+#endif
+
+#if BUTTONS_STORM_PROTECTION
+    /**
+     * Returns true if the specified button is quarantined: its pin changed level so often that
+     * its interrupt has been detached, and it is being polled until the pin goes quiet.
+     * The button's state continues to be tracked, at the polling rate, while it is quarantined.
+     *
+     * @param buttonId          Index of the button.
+     * @return                  true if the button is quarantined, false otherwise.
+     */
+    boolean quarantined(ButtonIndex buttonId);
+#endif
+
+#if BUTTONS_RAW_EDGES
+    /**
+     * Sets a function to be called straight from the ISR on the first edge of each transition,
+     * before anything else is done with it, for applications such as a buzzer system that
+     * must react within microseconds and can put up with being wrong now and then.
+     * Once the button has been quiet for the debounce period, update() reports whether the
+     * edge was real with EVENT_EDGE_CONFIRMED, or a glitch with EVENT_EDGE_CANCELLED, which
+     * is followed by the release or press that puts the button back as it was. Nothing is
+     * reported if the button is disabled or quarantined first.
+     * The callback runs in interrupt context, so it must be short and must not call back into
+     * this class. It is passed the new state of the button, which down() does not yet show.
+     *
+     * @param callback          Function to call, or nullptr for none.
+     * @param context           Passed to the callback.
+     */
+    void onRawEdge(ButtonCallback callback, void* context = nullptr);
+#endif
+
+#if BUTTONS_ARBITRATION
+    /**
+     * Number of buttons, starting from button 0, that take part in arbitration.
+     */
+    static const byte ARBITRATION_BUTTONS = 16;
+
+    /**
+     * The presses recorded in a round of arbitration, in the order they were made.
+     */
+    struct Arbitration
+    {
+      /**
+       * Value of micros() when the round was started by begin() or resetArbitration().
+       */
+      unsigned long startedAt;
+
+      /**
+       * Number of buttons pressed so far.
+       */
+      byte count;
+
+      /**
+       * The buttons pressed, the winner first, and the value of micros() at each press.
+       */
+      ButtonIndex order[ARBITRATION_BUTTONS];
+      unsigned long times[ARBITRATION_BUTTONS];
+    };
+
+    /**
+     * Starts a new round of arbitration, forgetting every press recorded.
+     *
+     * In each round, the ISR records the value of micros() at the first edge of the first
+     * press of each of buttons 0 to 15. The first button pressed is the winner, and stays so
+     * until the next round; any further presses of a button already recorded are ignored.
+     * Each of those buttons has an ISR of its own that reads micros() before doing anything
+     * else, so every button is timed in the same way. Two buttons pressed within a few
+     * microseconds of each other may still be recorded in the order their interrupts are
+     * serviced, but with the same time, so the application can see that it was a tie.
+     * Debouncing does not delay this, so a glitch on a pin can count as a press.
+     */
+    void resetArbitration();
+
+    /**
+     * Returns the winner of the current round of arbitration, or NO_BUTTON if no button
+     * has been pressed since it started.
+     */
+    ButtonIndex arbitrationWinner();
+
+    /**
+     * Copies out every press recorded in the current round of arbitration.
+     *
+     * @param result            Receives the presses.
+     */
+    void arbitration(Arbitration& result);
+#endif
+
+#if BUTTONS_STATISTICS
+    /**
+     * Bounce statistics gathered by the ISR for a single button.
+     * All counters saturate rather than wrapping.
+     */
+    struct Statistics
+    {
+      /**
+       * Number of transitions accepted by the debounce routine.
+       */
+      uint16_t transitions;
+
+      /**
+       * Number of edges rejected by the debounce routine as contact bounce.
+       */
+      uint16_t bounces;
+
+      /**
+       * Largest number of bounce edges seen following a single accepted transition.
+       */
+      uint8_t maxBounceBurst;
+
+      /**
+       * Longest time, in milliseconds, from an accepted transition to the last
+       * bounce edge that followed it.
+       */
+      uint16_t maxBounceDuration;
+    };
+
+    /**
+     * Copies the bounce statistics of the specified button.
+     *
+     * @param buttonId          Index of the button whose statistics are to be read.
+     * @param stats             Receives a consistent snapshot of the statistics.
+     * @return                  true on success, false if the object has not been started
+     *                          or buttonId is out of range.
+     */
+    boolean statistics(ButtonIndex buttonId, Statistics& stats);
+
+    /**
+     * Resets the bounce statistics of all buttons to zero.
+     */
+    void resetStatistics();
+
+    /**
+     * Resets the bounce statistics of the specified button to zero.
+     *
+     * @param buttonId          Index of the button whose statistics are to be reset.
+     */
+    void resetStatistics(ButtonIndex buttonId);
+#endif
+
+#if BUTTONS_ISR_PROFILING
+    /**
+     * Execution profile of the button ISR.
+     * Times are in CPU cycles on cores with a cycle counter (Cortex-M3 and up),
+     * and in microseconds everywhere else; see profileUnitsAreCycles().
+     */
+    struct IsrProfile
+    {
+      /**
+       * Number of times the ISR has run. Saturates, after which avgTime is that of the
+       * runs counted.
+       */
+      uint32_t invocations;
+
+      /**
+       * Shortest execution time of the ISR.
+       */
+      uint32_t minTime;
+
+      /**
+       * Mean execution time of the ISR.
+       */
+      uint32_t avgTime;
+
+      /**
+       * Longest execution time of the ISR.
+       */
+      uint32_t maxTime;
+
+      /**
+       * Largest number of invocations seen within any BUTTONS_ISR_RATE_WINDOW milliseconds.
+       */
+      uint16_t peakRate;
+    };
+
+    /**
+     * Copies the current ISR execution profile.
+     *
+     * @param profile           Receives a consistent snapshot of the profile.
+     */
+    void isrProfile(IsrProfile& profile);
+
+    /**
+     * Clears the ISR execution profile.
+     */
+    void resetIsrProfile();
+
+    /**
+     * Writes the ISR execution profile as a single compact line of text.
+     *
+     * @param out               Stream to write the profile to.
+     */
+    void printIsrProfile(Print& out = Serial);
+
+    /**
+     * Returns true if ISR execution times are measured in CPU cycles,
+     * false if they are measured in microseconds.
+     */
+    static constexpr boolean profileUnitsAreCycles()
+    {
+      return BUTTONS_HAS_CYCLE_COUNTER;
+    }
+#endif
+
+#if BUTTONS_LATENCY_TRACKING
+    /**
+     * Returns the delay, in microseconds, from the ISR accepting a transition to the
+     * application consuming it, that the given percentage of this button's recorded
+     * transitions did not exceed.
+     * A transition is consumed when clicked() or released() first returns true for it,
+     * or when its Change Flag is cleared.
+     * Delays are recorded in power-of-two buckets, so the result is the upper bound of
+     * the bucket containing the percentile.
+     *
+     * @param buttonId          Index of the button whose latency is to be read.
+     * @param percent           Percentile to return, from 0 to 100.
+     * @return                  The latency percentile in microseconds, or 0 if nothing
+     *                          has been recorded.
+     */
+    unsigned long latencyPercentile(ButtonIndex buttonId, byte percent);
+
+    /**
+     * Returns the number of consumed transitions recorded for a button.
+     *
+     * @param buttonId          Index of the button whose latency is to be read.
+     * @return                  The number of latency samples held.
+     */
+    unsigned long latencySamples(ButtonIndex buttonId);
+
+    /**
+     * Discards the latency samples of all buttons.
+     */
+    void resetLatency();
+
+    /**
+     * Discards the latency samples of the specified button.
+     *
+     * @param buttonId          Index of the button whose latency samples are to be discarded.
+     */
+    void resetLatency(ButtonIndex buttonId);
+#endif
+
+    //This class is a singleton so copying it around will have no effect
+    //and the default constructor will do as there's nothing to construct.
+    ButtonsClass() = default;
+    ~ButtonsClass() = default;
+    ButtonsClass& operator=(const ButtonsClass&) = default;
+    ButtonsClass(const ButtonsClass&) = default;
+
+  private:
+
+    /**
+     * Debounce period in milliseconds.
+     */
+    static const unsigned long DEBOUNCE_DELAY = 50;
+
+    /**
+     * Time in milliseconds allowed after begin() for the pullups to settle,
+     * during which changes are not reported.
+     */
+    static const unsigned long PULLUP_SETTLE_TIME = 10;
+
+    /**
+     * Value in _buttonPins of a button ID that is not in use.
+     */
+    static const byte NO_PIN = 0xFF;
+
+    /**
+     * Type of the time each button keeps of its last change, set by BUTTONS_TIMESTAMP_BITS
+     * in ButtonsConfig.h, in ticks of BUTTONS_TIMESTAMP_TICK milliseconds.
+     */
+#if BUTTONS_TIMESTAMP_BITS == 32
+    typedef unsigned long Timestamp;
+#elif BUTTONS_TIMESTAMP_BITS == 16
+    typedef uint16_t Timestamp;
+#else
+    typedef uint8_t Timestamp;
+#endif
+
+    /**
+     * Debounce period in ticks, rounded down, so an edge is accepted once more than this
+     * many ticks have passed since the last.
+     */
+    static const Timestamp DEBOUNCE_TICKS = DEBOUNCE_DELAY / BUTTONS_TIMESTAMP_TICK;
+
+#if BUTTONS_TIMESTAMP_BITS < 32
+    /**
+     * Age in ticks, half the range of a Timestamp, beyond which a compact time is no longer
+     * counted. Every SWEEP_INTERVAL milliseconds update() brings older times up to it,
+     * so that none can get so old as to wrap round and look recent.
+     */
+    static const Timestamp SATURATED_TICKS = (Timestamp)1 << (BUTTONS_TIMESTAMP_BITS - 1);
+    static const unsigned long SWEEP_INTERVAL = (SATURATED_TICKS / 2) * BUTTONS_TIMESTAMP_TICK;
+
+    static_assert(DEBOUNCE_TICKS < SATURATED_TICKS / 2,
+                  "BUTTONS_TIMESTAMP_TICK is too short for the debounce period to fit in a compact time");
+#endif
+
+    /**
+     * Set of buttons whose Change Flag is set.
+     */
+    typedef ButtonsChangeSet<ButtonIndex> ChangeSet;
+
+    /**
+     * This structure encompasses information relating to an individual button.
+     */
+    struct Button
+    {
+      /**
+       * Set when the ISR is to look at this button: it is in use and has not been disabled.
+       */
+      boolean enabled;
+
+      /**
+       * Stores the most recently measured state of the button.
+       * true = pushed, false = not pushed.
+       */
+      boolean currentState;
+
+      /**
+       * Set while the button's pullup is settling after it was started, during which the
+       * ISR follows its pin without reporting changes.
+       */
+      boolean settling;
+
+      /**
+       * Bumped by the ISR before and after it updates currentState, lastChangeTime or the
+       * Change Flag, so that it is odd while the update is under way and different afterwards.
+       * Readers use it to tell whether what they read was torn, without holding the ISR off.
+       */
+      uint8_t generation;
+
+      /**
+       * This records the last time that an Interrupt was triggered from this pin.
+       * Used as part of the debounce routine.
+       */
+      Timestamp lastChangeTime;
+
+      /**
+       * Number of presses and releases accepted since each was last taken.
+       */
+      ClickCount presses;
+      ClickCount releases;
+
+#if BUTTONS_EVENT_QUEUE_SIZE
+      /**
+       * Set when an edge has been rejected as bounce and update() has been asked to
+       * confirm the state once the bounce has settled.
+       */
+      boolean confirmPending;
+#endif
+
+#if BUTTONS_RAW_EDGES
+      /**
+       * Set when the raw edge callback has been told of a transition that has yet to be
+       * confirmed or cancelled.
+       */
+      boolean provisional;
+#endif
+
+#if BUTTONS_STORM_PROTECTION
+      /**
+       * Level of the pin when the ISR last read it, whether or not that was accepted.
+       */
+      boolean rawState;
+
+      /**
+       * Set while the button's interrupt is detached because of an interrupt storm.
+       */
+      boolean quarantined;
+
+      /**
+       * Number of level changes seen in the current storm window, and the low 16 bits of
+       * millis() at which that window started.
+       */
+      uint8_t stormEdges;
+      uint16_t stormWindowStart;
+#endif
+
+#if BUTTONS_STATISTICS
+      /**
+       * Bounce statistics for this button.
+       */
+      Statistics stats;
+
+      /**
+       * Number of bounce edges seen since the last accepted transition.
+       */
+      uint8_t burstEdges;
+
+      /**
+       * Low 16 bits of millis() at the last accepted transition, or when the button last
+       * took up the state of its pin, from which the duration of the following bounce
+       * burst is measured.
+       */
+      uint16_t burstStart;
+#endif
+
+#if BUTTONS_LATENCY_TRACKING
+      /**
+       * Value of micros() when the ISR last accepted a transition.
+       */
+      unsigned long acceptedAt;
+
+      /**
+       * Set when a transition is accepted, cleared once its latency has been recorded.
+       */
+      boolean latencyPending;
+#endif
+
+      /**
+       * Constructor for objects of Button.
+       */
+      Button() :
+        enabled(false),
+        currentState(false),
+        settling(false),
+        generation(0),
+        lastChangeTime(0),
+        presses(0),
+        releases(0)
+#if BUTTONS_EVENT_QUEUE_SIZE
+        , confirmPending(false)
+#endif
+#if BUTTONS_RAW_EDGES
+        , provisional(false)
+#endif
+#if BUTTONS_STORM_PROTECTION
+        , rawState(false)
+        , quarantined(false)
+        , stormEdges(0)
+        , stormWindowStart(0)
+#endif
+#if BUTTONS_STATISTICS
+        , stats()
+        , burstEdges(0)
+        , burstStart(0)
+#endif
+#if BUTTONS_LATENCY_TRACKING
+        , acceptedAt(0)
+        , latencyPending(false)
+#endif
+      { }
+    };
+
+#if BUTTONS_LATENCY_TRACKING
+    /**
+     * Number of buckets in each latency histogram. Bucket b counts delays of
+     * 2^b to 2^(b+1)-1 microseconds, except for the first, which also counts 0,
+     * and the last, which counts everything longer.
+     */
+    static const byte LATENCY_BUCKETS = 24;
+
+    /**
+     * Histogram of consumption latencies for a single button.
+     * This is only touched from the main program, never the ISR, so it is kept apart
+     * from the volatile Button objects.
+     */
+    struct LatencyHistogram
+    {
+      uint16_t buckets[LATENCY_BUCKETS];
+
+      LatencyHistogram() :
+        buckets()
+      { }
+    };
+
+    /**
+     * Records the latency of the transition last accepted on the specified button,
+     * if it has not already been recorded.
+     */
+    static void consumeTransition(ButtonIndex buttonId);
+
+    /**
+     * This array stores a latency histogram for each button controlled by this class.
+     */
+    static LatencyHistogram* _latency;
+#endif
+
+    /**
+     * This function is called whenever a button interrupt is fired.
+     * It reads all the button states and updates their _buttonStatus objects
+     * accordingly.
+     */
+    static void button_ISR();
+
+    /**
+     * Does the work of the ISR for buttons first to end - 1, and for every button whose
+     * pullup is settling.
+     */
+    static inline void serviceButtons(ButtonIndex first, ButtonIndex end);
+
+    /**
+     * Attaches the interrupt of a button's pin to the appropriate ISR.
+     */
+    static void attachButton(ButtonIndex buttonId);
+
+#if BUTTONS_ARBITRATION
+    /**
+     * ISR of button N, when it takes part in arbitration. This times the edge before
+     * anything else, then services that button alone.
+     */
+    template <byte N>
+    static void pinISR();
+
+    /**
+     * pinISR() for each button that takes part in arbitration, indexed by button.
+     */
+    static void (* const _pinIsrs[ARBITRATION_BUTTONS])();
+
+    /**
+     * Records a press of a button in the current round of arbitration, if it is the first.
+     * Must be called from the ISR.
+     */
+    static inline void arbitrate(byte buttonId, unsigned long time);
+
+    /**
+     * The current round of arbitration: the buttons pressed, as a mask and in order,
+     * the value of micros() at each press, and when the round started.
+     */
+    static volatile uint16_t _arbitrationMask;
+    static volatile byte _arbitrationCount;
+    static volatile ButtonIndex _arbitrationOrder[ARBITRATION_BUTTONS];
+    static volatile unsigned long _arbitrationTimes[ARBITRATION_BUTTONS];
+    static unsigned long _arbitrationStart;
+#endif
+
+    /**
+     * Sleeps until the next interrupt of any kind, unless a button interrupt has been seen
+     * since _buttonWake was last cleared.
+     */
+    static void sleepUntilInterrupt();
+
+    /**
+     * Replaces the per-button arrays with new ones of the specified size, which must be no
+     * smaller than the current one, carrying over the state of every button.
+     * The new arrays are built first, then swapped in with the ISR held off.
+     *
+     * @return                  true on success, false if memory ran out.
+     */
+    static boolean resizeButtons(ButtonIndex count);
+
+    /**
+     * Starts the pullup settle period again, for the buttons whose settling flag is set
+     * from now on, as after begin().
+     */
+    static void startSettling();
+
+    /**
+     * Accepts a transition of a button to a new state, updating everything that tracks transitions.
+     * Must be called from the ISR, or with interrupts disabled.
+     */
+    static inline void acceptTransition(ButtonIndex buttonId, boolean state, unsigned long now);
+
+    /**
+     * Set and clear the Change Flag of a button. Must be called from the ISR, or with
+     * interrupts disabled.
+     */
+    static inline void setChanged(ButtonIndex buttonId);
+    static inline void clearChanged(ButtonIndex buttonId);
+
+    /**
+     * Copies a new state of a button into _fastDown. Must be called wherever currentState
+     * is set, from the ISR or with interrupts disabled.
+     */
+    static inline void mirrorState(ButtonIndex buttonId, boolean state);
+
+    /**
+     * Starts measuring a new bounce burst of a button from now. Must be called wherever
+     * lastChangeTime is moved on to a new state, from the ISR or with interrupts disabled.
+     */
+    static inline void restartBurst(ButtonIndex buttonId, unsigned long now);
+
+    /**
+     * Converts a value of millis() to a Timestamp.
+     */
+    static inline Timestamp timestamp(unsigned long time);
+
+    /**
+     * Returns the milliseconds from a Timestamp to now, or MAX_ELAPSED if it is older than that.
+     */
+    static inline unsigned long elapsedSince(Timestamp stamp, unsigned long now);
+
+    /**
+     * Returns the value of millis() at a Timestamp, given the time now.
+     */
+    static inline unsigned long timeOf(Timestamp stamp, unsigned long now);
+
+    /**
+     * Returns the value of millis() from which an edge is no longer bounce, given the Timestamp
+     * of the last edge and the time now.
+     */
+    static inline unsigned long settledAt(Timestamp stamp, unsigned long now);
+
+#if BUTTONS_TIMESTAMP_BITS < 32
+    /**
+     * Brings the time of every button's last change up to SATURATED_TICKS old if it is older,
+     * and sets when to do so next.
+     */
+    static void sweepTimestamps(unsigned long now);
+
+    /**
+     * Value of millis() at which update() is next to call sweepTimestamps().
+     */
+    static unsigned long _nextSweep;
+#endif
+
+    /**
+     * Accounts for an edge on a button that has been rejected as bounce.
+     * Must be called from the ISR.
+     */
+    static inline void rejectEdge(ButtonIndex buttonId, unsigned long now);
+
+#if BUTTONS_EVENT_QUEUE_SIZE
+    /**
+     * Asks update() to check the state of a button once it has stopped bouncing.
+     * Must be called from the ISR.
+     */
+    static inline void requestConfirm(ButtonIndex buttonId);
+#endif
+
+#if BUTTONS_RAW_EDGES
+    /**
+     * Tells the raw edge callback of a transition the ISR has just accepted, settling
+     * any earlier one still outstanding. Must be called from the ISR.
+     */
+    static inline void rawEdge(ButtonIndex buttonId, boolean state, unsigned long now);
+
+    /**
+     * The raw edge callback and its context; see onRawEdge().
+     */
+    static ButtonCallback volatile _rawEdgeCallback;
+    static void* volatile _rawEdgeContext;
+#endif
+
+#if BUTTONS_STORM_PROTECTION
+    /**
+     * Counts a change in the level of a button's pin, and quarantines the button if it is
+     * changing too often. Must be called from the ISR.
+     *
+     * @return                  true if the button has been quarantined.
+     */
+    static inline boolean stormEdge(ButtonIndex buttonId, unsigned long now);
+#endif
+
+#if BUTTONS_EVENT_QUEUE_SIZE
+    /**
+     * Kinds of timing deadline. Those before TIMER_BUTTON_KINDS are held per button,
+     * and are identified by the button index; those after are identified by an index
+     * of their own.
+     */
+    enum TimerKind : byte
+    {
+      TIMER_DEBOUNCE,
+#if BUTTONS_GESTURES
+      TIMER_GESTURE,
+#endif
+#if BUTTONS_MAX_CHORDS
+      TIMER_CHORD_DEFER,
+#endif
+#if BUTTONS_AUTO_REPEAT
+      TIMER_REPEAT,
+#endif
+#if BUTTONS_STORM_PROTECTION
+      TIMER_QUARANTINE,
+#endif
+      TIMER_BUTTON_KINDS,
+#if BUTTONS_MAX_CHORDS
+      TIMER_CHORD = TIMER_BUTTON_KINDS,
+#endif
+    };
+
+    /**
+     * This structure holds the state of a button that is only ever touched from the main
+     * program, through update(), and so does not need to be volatile.
+     */
+    struct ButtonContext
+    {
+      /**
+       * The per-button timers of this button.
+       */
+      ButtonsTimer timers[TIMER_BUTTON_KINDS];
+
+#if BUTTONS_GESTURES
+      /**
+       * Current state of the gesture recogniser, and whether it is enabled.
+       */
+      byte gestureState;
+      boolean gesturesEnabled;
+
+      /**
+       * Number of presses in the click sequence currently being recognised.
+       */
+      byte gestureClicks;
+
+      /**
+       * Time of the press that started the current gesture.
+       */
+      unsigned long gesturePressTime;
+#endif
+
+#if BUTTONS_MAX_CHORDS
+      /**
+       * Time of this button's press while it is being held back for a chord.
+       */
+      unsigned long deferredPressTime;
+#endif
+
+#if BUTTONS_AUTO_REPEAT
+      /**
+       * Whether this button auto-repeats, the number of repeats since it was pressed,
+       * and the current interval between them.
+       */
+      boolean repeatEnabled;
+      byte repeatCount;
+      uint16_t repeatInterval;
+#endif
+
+#if BUTTONS_STORM_PROTECTION
+      /**
+       * Level of the pin at the last poll while quarantined, and the time it last changed.
+       */
+      boolean pollState;
+      unsigned long quietSince;
+#endif
+
+      ButtonContext() :
+        timers()
+#if BUTTONS_GESTURES
+        , gestureState(0)
+        , gesturesEnabled(true)
+        , gestureClicks(0)
+        , gesturePressTime(0)
+#endif
+#if BUTTONS_MAX_CHORDS
+        , deferredPressTime(0)
+#endif
+#if BUTTONS_AUTO_REPEAT
+        , repeatEnabled(false)
+        , repeatCount(0)
+        , repeatInterval(0)
+#endif
+#if BUTTONS_STORM_PROTECTION
+        , pollState(false)
+        , quietSince(0)
+#endif
+      { }
+    };
+
+    /**
+     * Acts on a press or release taken from the ISR transition queue.
+     */
+    static void processTransition(const Event& transition);
+
+    /**
+     * Passes a press or release, that has not been held back or discarded by chord
+     * detection, on to the event queue and gesture recogniser.
+     */
+    static void deliverTransition(EventType type, ButtonIndex buttonId, unsigned long time);
+
+    /**
+     * Adds an event to the queue read by readEvent().
+     */
+    static void postEvent(EventType type, ButtonIndex buttonId, unsigned long time);
+
+    /**
+     * Returns the timer of the specified kind and index.
+     */
+    static ButtonsTimer& timer(TimerKind kind, ButtonIndex index);
+
+    /**
+     * Arms a timer, replacing its previous deadline if it was already armed.
+     */
+    static void setTimer(TimerKind kind, ButtonIndex index, unsigned long when);
+
+    /**
+     * Disarms a timer, if it is armed.
+     */
+    static void cancelTimer(TimerKind kind, ButtonIndex index);
+
+    /**
+     * Fires every armed timer that is due at or before the specified time, in deadline order,
+     * and brings _nextDeadline up to date.
+     */
+    static void expireTimers(unsigned long now);
+
+    /**
+     * Called when a timer fires.
+     */
+    static void timerExpired(TimerKind kind, ButtonIndex index, unsigned long when);
+
+    /**
+     * Type of the queues filled by the ISR. See BUTTONS_MPSC_QUEUE.
+     */
+#if BUTTONS_MPSC_QUEUE
+    template <typename T, byte SIZE>
+    using IsrQueue = ButtonsMpscRing<T, SIZE>;
+#else
+    template <typename T, byte SIZE>
+    using IsrQueue = ButtonsRing<T, SIZE>;
+#endif
+
+    /**
+     * Queue of accepted transitions, filled by the ISR and drained by update().
+     */
+    static IsrQueue<Event, BUTTONS_EVENT_QUEUE_SIZE> _transitions;
+
+    /**
+     * Queue of events, filled by update() and drained by readEvent().
+     */
+    static ButtonsRing<Event, BUTTONS_EVENT_QUEUE_SIZE> _events;
+
+    /**
+     * This array stores the main-program state for each button controlled by this class.
+     */
+    static ButtonContext* _buttonContext;
+
+    /**
+     * Checks a button whose last edge was rejected as bounce once its debounce period is over,
+     * in case that edge left it in a different state to the one last accepted.
+     */
+    static void confirmDebounce(ButtonIndex buttonId);
+
+    /**
+     * Queue of buttons that have had an edge rejected as bounce, filled by the ISR and
+     * drained by update(), which schedules confirmDebounce() for them.
+     */
+    static IsrQueue<ButtonIndex, BUTTONS_EVENT_QUEUE_SIZE> _unsettled;
+
+    /**
+     * Abandons everything a button has in progress: its gesture, chord and auto-repeat state
+     * and their timers. If it is being removed, its debounce and quarantine timers are
+     * cancelled too, and its settings are returned to their defaults.
+     */
+    static void stopButton(ButtonIndex buttonId, boolean removing);
+
+#if BUTTONS_STORM_PROTECTION
+    /**
+     * Starts polling a button that the ISR has quarantined.
+     */
+    static void startQuarantine(ButtonIndex buttonId, unsigned long time);
+
+    /**
+     * Polls a quarantined button, and returns it to interrupts once its pin has gone quiet.
+     */
+    static void pollQuarantined(ButtonIndex buttonId, unsigned long when);
+#endif
+
+    /**
+     * The timer wheel on which all timing deadlines are scheduled.
+     */
+    static ButtonsTimerWheel _timerWheel;
+
+    /**
+     * Earliest deadline of any armed timer, valid only while _timerArmed is set.
+     * This may be earlier than any timer that is actually armed, as cancelling a timer
+     * does not recalculate it; that just costs one unnecessary pass of expireTimers().
+     * It allows update() to tell there is nothing to do with a single comparison.
+     */
+    static unsigned long _nextDeadline;
+    static boolean _timerArmed;
+#endif
+
+#if BUTTONS_GESTURES
+    /**
+     * States of the gesture recogniser.
+     */
+    enum GestureState : byte
+    {
+      GESTURE_IDLE,         // Up, nothing in progress.
+      GESTURE_DOWN,         // Down, not yet for long enough to be a long press.
+      GESTURE_DOWN_LONG,    // Down, long enough to be a long press but not yet a hold.
+      GESTURE_HOLDING,      // Down, holding.
+      GESTURE_UP_WAIT,      // Up after one or more clicks, waiting to see if another follows.
+      GESTURE_STATES
+    };
+
+    /**
+     * Inputs to the gesture recogniser.
+     */
+    enum GestureInput : byte
+    {
+      GESTURE_IN_PRESS,
+      GESTURE_IN_RELEASE,
+      GESTURE_IN_TIMEOUT,
+      GESTURE_INPUTS
+    };
+
+    /**
+     * Actions taken on gesture recogniser transitions.
+     */
+    enum GestureAction : byte
+    {
+      GESTURE_NONE,         // Nothing.
+      GESTURE_START,        // First press of a gesture: start counting clicks and timing the press.
+      GESTURE_ADD_PRESS,    // Subsequent press of a multi-click: count it and time the press.
+      GESTURE_CLICK_UP,     // Short press released: wait for another unless at a triple click.
+      GESTURE_LONG,         // Long press time passed: report any earlier clicks, time the hold.
+      GESTURE_EMIT_LONG,    // Report a long press.
+      GESTURE_EMIT_HOLD,    // Report the start of a hold.
+      GESTURE_EMIT_UNHOLD,  // Report the end of a hold.
+      GESTURE_EMIT_CLICKS   // Multi-click window closed: report the clicks counted.
+    };
+
+    /**
+     * One entry of the gesture transition table: the state to move to and the action to take.
+     */
+    struct GestureRule
+    {
+      byte next;
+      byte action;
+    };
+
+    /**
+     * The gesture transition table, indexed by current state and input.
+     */
+    static const GestureRule GESTURE_TABLE[GESTURE_STATES][GESTURE_INPUTS] PROGMEM;
+
+    /**
+     * Feeds one input to a button's gesture recogniser.
+     */
+    static void gestureInput(ButtonIndex buttonId, GestureInput input, unsigned long time);
+
+    /**
+     * Reports a multi-click gesture of the given number of clicks.
+     */
+    static void emitClicks(ButtonIndex buttonId, byte clicks, unsigned long time);
+
+    /**
+     * Gesture timings, in milliseconds.
+     */
+    static uint16_t _longPressTime;
+    static uint16_t _holdTime;
+    static uint16_t _multiClickWindow;
+#endif
+
+#if BUTTONS_MAX_CHORDS
+    /**
+     * States of a chord.
+     */
+    enum ChordState : byte
+    {
+      CHORD_IDLE,           // Not all buttons down, or not pressed within the tolerance.
+      CHORD_COMPLETE,       // All buttons down within the tolerance, waiting out the hold time.
+      CHORD_FIRED           // EVENT_CHORD has been reported.
+    };
+
+    /**
+     * This structure holds a registered chord.
+     */
+    struct Chord
+    {
+      /**
+       * The buttons making up the chord. Zero if this entry is not in use.
+       */
+      ButtonMask mask;
+
+      /**
+       * Timings, in milliseconds; see addChord().
+       */
+      uint16_t holdTime;
+      uint16_t tolerance;
+
+      /**
+       * Whether the individual button events of the chord are suppressed.
+       */
+      boolean suppress;
+
+      /**
+       * Current ChordState.
+       */
+      byte state;
+
+      /**
+       * Time that the first of the chord's buttons currently down was pressed.
+       */
+      unsigned long startTime;
+
+      /**
+       * The hold time timer for this chord.
+       */
+      ButtonsTimer holdTimer;
+
+      Chord() :
+        mask(0),
+        holdTime(0),
+        tolerance(0),
+        suppress(false),
+        state(CHORD_IDLE),
+        startTime(0),
+        holdTimer()
+      { }
+    };
+
+    /**
+     * Updates chord state for a press or release of a button that can take part in chords.
+     * Returns true if the transition is to be passed on, false if it has been held back
+     * or discarded.
+     */
+    static boolean chordTransition(EventType type, ButtonIndex buttonId, unsigned long time);
+
+    /**
+     * Delivers the press of a button that was held back for a chord which did not form.
+     */
+    static void releaseDeferredPress(ButtonIndex buttonId);
+
+    /**
+     * The chord table.
+     */
+    static Chord _chords[BUTTONS_MAX_CHORDS];
+
+    /**
+     * Buttons that are down, according to the transitions processed so far.
+     */
+    static ButtonMask _downMask;
+
+    /**
+     * Buttons whose press is being held back while a chord may still form.
+     */
+    static ButtonMask _deferredMask;
+
+    /**
+     * Buttons that form part of a suppressed chord, whose events are discarded until released.
+     */
+    static ButtonMask _claimedMask;
+#endif
+
+#if BUTTONS_AUTO_REPEAT
+    /**
+     * Reports a repeat of a held button and schedules the next.
+     */
+    static void autoRepeat(ButtonIndex buttonId, unsigned long when);
+
+    /**
+     * Auto-repeat timings; see setAutoRepeatTiming().
+     */
+    static uint16_t _repeatDelay;
+    static uint16_t _repeatInterval;
+    static byte _repeatAccelerateAfter;
+    static uint16_t _repeatMinInterval;
+#endif
+
+#if BUTTONS_MAX_SEQUENCES
+    /**
+     * Marks an unused entry in the sequence tables.
+     */
+    static const byte SEQUENCE_NONE = 0xFF;
+
+    /**
+     * Advances the sequence automaton on a press.
+     */
+    static void sequenceInput(ButtonIndex buttonId, unsigned long time);
+
+    /**
+     * Rebuilds the sequence automaton from the registered sequences.
+     * Returns false if they do not fit within the automaton limits.
+     */
+    static boolean compileSequences();
+
+    /**
+     * The registered sequences, as button indices, and the length of each; zero if unused.
+     */
+    static ButtonIndex _sequences[BUTTONS_MAX_SEQUENCES][BUTTONS_MAX_SEQUENCE_LENGTH];
+    static byte _sequenceLengths[BUTTONS_MAX_SEQUENCES];
+
+    /**
+     * The button index that each input symbol of the automaton stands for,
+     * and the number of input symbols in use.
+     */
+    static ButtonIndex _sequenceButtons[BUTTONS_SEQUENCE_BUTTONS];
+    static byte _sequenceSymbols;
+
+    /**
+     * The automaton: the state to move to from each state on each input symbol,
+     * and the set of sequences recognised on entering each state.
+     * It is a complete Aho-Corasick automaton, so every entry is valid and no
+     * failure links need to be followed at run time.
+     */
+    static byte _sequenceNext[BUTTONS_SEQUENCE_STATES][BUTTONS_SEQUENCE_BUTTONS];
+    static uint16_t _sequenceMatches[BUTTONS_SEQUENCE_STATES];
+
+    /**
+     * Current state of the automaton, and the time of the last press fed to it.
+     */
+    static byte _sequenceState;
+    static unsigned long _sequenceLastPress;
+
+    /**
+     * Longest time allowed between two presses of a sequence, in milliseconds.
+     */
+    static uint16_t _sequenceTimeout;
+#endif
+
+#if BUTTONS_MAX_CALLBACKS
+    /**
+     * A registered callback: the function and its context, and what it is to be called for.
+     * If buttonId is NO_BUTTON the callback is for the buttons in mask, otherwise it is for
+     * that button alone, which need not be one of the first 32.
+     * An entry with no triggers is unused.
+     */
+    struct Delegate
+    {
+      ButtonCallback function;
+      void* context;
+      ButtonMask mask;
+      ButtonIndex buttonId;
+      byte triggers;
+    };
+
+    /**
+     * Registers a callback in the first free entry of the table.
+     */
+    static int8_t addDelegate(ButtonIndex buttonId, ButtonMask mask, byte triggers,
+                              ButtonCallback callback, void* context);
+
+    /**
+     * Makes the callbacks registered for one change of one button; used by dispatch().
+     */
+    static void dispatchChange(ButtonIndex buttonId, boolean down, void* context);
+
+    /**
+     * The registered callbacks.
+     */
+    static Delegate _callbacks[BUTTONS_MAX_CALLBACKS];
+#endif
+
+    /**
+     * Reads, and optionally resets, one of a button's press or release counters
+     * without the ISR being able to update it part-way through.
+     */
+    static ClickCount readCount(volatile ClickCount& counter, boolean reset);
+
+#if BUTTONS_ISR_PROFILING
+    /**
+     * Returns the current time in the units used by the ISR profile.
+     */
+    static inline uint32_t profileTimestamp();
+
+    /**
+     * Folds one ISR execution, which began at start, into the ISR profile.
+     * Called at the end of the ISR.
+     */
+    static void recordIsrProfile(uint32_t start);
+
+    /**
+     * Number of sub-windows used to approximate the sliding interrupt rate window.
+     */
+    static const byte ISR_RATE_SLOTS = 4;
+
+    /**
+     * ISR profile accumulators. The mean is derived from the total on request.
+     */
+    static volatile uint32_t _isrInvocations;
+    static volatile uint32_t _isrMinTime;
+    static volatile uint32_t _isrMaxTime;
+    static volatile uint64_t _isrTotalTime;
+    static volatile uint16_t _isrPeakRate;
+
+    /**
+     * Invocation counts for each sub-window of the interrupt rate window,
+     * and the index of the sub-window (millis() / sub-window length) most recently counted into.
+     */
+    static volatile uint16_t _isrRateSlots[ISR_RATE_SLOTS];
+    static volatile unsigned long _isrRateEpoch;
+#endif
+
+    /**
+     * Pointers to the per-button arrays, all of the same size.
+     */
+    struct ButtonArrays
+    {
+      byte* pins;
+      Button* status;
+      ChangeSet::Word* changed;
+#if BUTTONS_LATENCY_TRACKING
+      LatencyHistogram* latency;
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+      ButtonContext* context;
+#endif
+    };
+
+    /**
+     * Allocates per-button arrays of the specified size from the heap.
+     *
+     * @return                  true on success. On failure, nothing is left allocated.
+     */
+    static boolean allocateArrays(ButtonIndex count, ButtonArrays& arrays);
+
+    /**
+     * Frees per-button arrays allocated by allocateArrays().
+     */
+    static void freeArrays(const ButtonArrays& arrays);
+
+    /**
+     * Does the work of begin(), given the arrays to keep button state in.
+     *
+     * @param capacity          Size of the arrays, no less than numberOfButtons.
+     * @param owned             true if the arrays came from allocateArrays(), and so are
+     *                          to be freed by end() and may be reallocated to grow them.
+     */
+    static boolean start(const byte* const buttonPins, ButtonIndex numberOfButtons, ButtonIndex capacity,
+                         const ButtonArrays& arrays, boolean owned);
+
+    /**
+     * Stores the number of buttons controlled by this class,
+     * which is also the size of the _buttonPins and _buttonStatus arrays
+     * in use. The arrays themselves hold _capacity buttons.
+     */
+    static ButtonIndex _numberOfButtons;
+    static ButtonIndex _capacity;
+
+    /**
+     * Set if the per-button arrays were allocated from the heap by this class,
+     * false if they were provided to begin().
+     */
+    static boolean _ownsArrays;
+
+    /**
+     * This array stores pin numbers for each button controlled by this class.
+     */
+    static byte* _buttonPins;
+
+    /**
+     * This array stores Button objects for each button controlled by this class,
+     * each containing relevant information for the servicing of the ISR.
+     * Its volatile because its members may be modified by an ISR, so we need to
+     * prevent register caching of member values.
+     */
+    static volatile Button* _buttonStatus;
+
+    /**
+     * The buttons whose Change Flag is set, kept as a bitmap in storage of
+     * ChangeSet::words(_capacity) words. Set by the ISR.
+     */
+    static ChangeSet _changed;
+
+    /**
+     * Set to true if this class has been initialised, false otherwise.
+     */
+    static boolean _begun;
+
+    /**
+     * Set by the ISR whenever it is called, so that sleepUntilEvent() knows why it woke.
+     */
+    static volatile boolean _buttonWake;
+
+    /**
+     * Set by begin() and addButton() and cleared by the ISR once PULLUP_SETTLE_TIME has passed
+     * since _settleStart. Until then the ISR tracks the pins of the buttons that are settling
+     * without reporting changes, while the rest carry on as normal.
+     */
+    static volatile boolean _settling;
+    static volatile unsigned long _settleStart;
+
+    /**
+     * Value of millis() at the last transition of any button, and a generation bumped
+     * either side of each update of it, as for Button::generation.
+     */
+    static volatile unsigned long _lastActivity;
+    static volatile uint8_t _activityGeneration;
+
+#if BUTTONS_FAST_QUERIES
+    /**
+     * Copies of currentState and the Change Flag of buttons 0 to BUTTONS_FAST_QUERIES - 1,
+     * a bit each, for the fast queries.
+     */
+    static volatile byte _fastDown[(BUTTONS_FAST_QUERIES + 7) / 8];
+    static volatile byte _fastChanged[(BUTTONS_FAST_QUERIES + 7) / 8];
+
+    static_assert(BUTTONS_FAST_QUERIES <= NO_BUTTON, "BUTTONS_FAST_QUERIES is more buttons than ButtonIndex can hold");
+
+    /**
+     * The checks made by the fast queries: none, unless BUTTONS_DEBUG is set.
+     */
+    static inline boolean fastCheck(ButtonIndex buttonId)
+    {
+#if BUTTONS_DEBUG
+      return _begun && buttonId < BUTTONS_FAST_QUERIES && buttonId < _numberOfButtons;
+#else
+      (void)buttonId;
+      return true;
+#endif
+    }
+
+    static inline boolean fastBit(const volatile byte* bits, ButtonIndex buttonId)
+    {
+      return (bits[buttonId / 8] >> (buttonId % 8)) & 1;
+    }
+#endif
+
+  public:
+
+    /**
+     * Number of bytes of RAM taken by each button, with the features currently configured,
+     * not counting the Change Flags, which take a little over one bit per button.
+     * This is the same whether the storage is allocated by begin() or provided.
+     */
+    static const size_t BYTES_PER_BUTTON = sizeof(byte) + sizeof(Button)
+#if BUTTONS_LATENCY_TRACKING
+      + sizeof(LatencyHistogram)
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+      + sizeof(ButtonContext)
+#endif
+      ;
+
+    /**
+     * Storage for the state of up to N buttons, to be passed to begin() so that the heap
+     * is not used. Normally declared as a global, through the ButtonStorage alias.
+     */
+    template <ButtonIndex N>
+    class Storage final
+    {
+      static_assert(N > 0, "ButtonStorage must hold at least one button");
+
+      friend class ButtonsClass;
+
+      ButtonArrays arrays()
+      {
+        ButtonArrays result;
+        result.pins = _pins;
+        result.status = _status;
+        result.changed = _changed;
+#if BUTTONS_LATENCY_TRACKING
+        result.latency = _latency;
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+        result.context = _context;
+#endif
+        return result;
+      }
+
+      Button _status[N];
+#if BUTTONS_LATENCY_TRACKING
+      LatencyHistogram _latency[N];
+#endif
+#if BUTTONS_EVENT_QUEUE_SIZE
+      ButtonContext _context[N];
+#endif
+      ChangeSet::Word _changed[ChangeSet::words(N)];
+      byte _pins[N];
+    };
+};
+
+/**
+ * Storage for the state of up to N buttons. See ButtonsClass::begin().
+ */
+template <ButtonsClass::ButtonIndex N>
+using ButtonStorage = ButtonsClass::Storage<N>;
 
 extern ButtonsClass Buttons;
 
@@ -0,0 +1,247 @@
+/*
+ *  Arduino Buttons Library
+ *  An interrupt-driven, fully-debounced class to manage input from physical buttons on the Arduino platform.
+ *
+ *  Copyright (C) 2017 Nicholas Parks Young
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/**
+ * Hierarchical bitmap holding the Change Flag of every button, so that the buttons
+ * that have changed can be found without looking at those that have not.
+ *
+ * Website: https://github.com/Alarm-Siren/arduino-buttons
+ *
+ *  DEFINITION FILE
+ *
+ * @author      Nicholas Parks Young
+ * @version     2.0.0
+ */
+
+#ifndef BUTTONS_CHANGE_SET_H
+#define BUTTONS_CHANGE_SET_H
+
+#include <Arduino.h>
+
+/**
+ * A set of button indices, held as a bitmap with one bit per button, over which sit
+ * summary bitmaps with one bit per word of the level below, up to a single word at the top.
+ * A bit is set in a summary whenever any bit is set in the word it stands for.
+ *
+ * Adding to the set costs one word update per level, and finding the next member costs at
+ * most two word reads per level, however many buttons there are. Whether the set is empty
+ * is a single word compare.
+ *
+ * Bits are only ever set by the ISR, and only cleared with it held off, so a search from
+ * the main program can at worst miss a bit being set while it runs.
+ *
+ * @param Index     Unsigned integer type of the indices, no wider than 16 bits.
+ */
+template <typename Index>
+class ButtonsChangeSet final
+{
+  public:
+
+    /**
+     * Type of each word of the bitmaps. The natural width of the processor, so that reading
+     * and updating a word is as cheap as it can be.
+     */
+    typedef unsigned int Word;
+
+    static const byte WORD_BITS = sizeof(Word) * 8;
+
+    /**
+     * Number of levels of bitmap needed for the top level to be a single word
+     * whatever the number of buttons.
+     */
+    static const byte LEVELS = (sizeof(Index) == 1) ? 2 : 4;
+
+    static_assert(sizeof(Index) <= 2, "ButtonsChangeSet indices must be no wider than 16 bits");
+    static_assert(sizeof(Word) >= 2, "ButtonsChangeSet words must be at least 16 bits");
+
+    /**
+     * Returned by next() when there are no more members.
+     */
+    static const Index NONE = (Index)~(Index)0;
+
+    /**
+     * Number of words of storage needed for a set of up to the specified number of buttons.
+     */
+    static constexpr size_t words(size_t count, byte levels = LEVELS)
+    {
+      return (levels == 0) ? 0 : (count + WORD_BITS - 1) / WORD_BITS
+                                 + words((count + WORD_BITS - 1) / WORD_BITS, levels - 1);
+    }
+
+    ButtonsChangeSet() :
+      _levels(),
+      _sizes()
+    { }
+
+    /**
+     * Uses the specified storage for a set of up to count buttons, and empties it.
+     *
+     * @param storage           At least words(count) words.
+     * @param count             Number of buttons.
+     */
+    void attach(Word* storage, size_t count)
+    {
+      for (byte level = 0; level < LEVELS; level++) {
+        count = (count + WORD_BITS - 1) / WORD_BITS;
+        _levels[level] = storage;
+        _sizes[level] = count;
+        for (size_t i = 0; i < count; i++) {
+          storage[i] = 0;
+        }
+        storage += count;
+      }
+    }
+
+    /**
+     * Forgets the storage, leaving the set empty and unusable until attach() is called again.
+     */
+    void detach()
+    {
+      for (byte level = 0; level < LEVELS; level++) {
+        _levels[level] = nullptr;
+        _sizes[level] = 0;
+      }
+    }
+
+    /**
+     * Returns the storage passed to attach(), or nullptr if there is none.
+     */
+    volatile Word* storage() const
+    {
+      return _levels[0];
+    }
+
+    /**
+     * Adds a button to the set. Must be called from the ISR, or with it held off.
+     */
+    inline void set(Index index)
+    {
+      size_t position = index;
+      for (byte level = 0; level < LEVELS; level++) {
+        volatile Word& word = _levels[level][position / WORD_BITS];
+        const Word bit = (Word)1 << (position % WORD_BITS);
+        // If this bit was already set, so is everything above it.
+        if (word & bit)
+          return;
+        word |= bit;
+        position /= WORD_BITS;
+      }
+    }
+
+    /**
+     * Removes a button from the set. Must be called with the ISR held off.
+     */
+    inline void clear(Index index)
+    {
+      size_t position = index;
+      for (byte level = 0; level < LEVELS; level++) {
+        volatile Word& word = _levels[level][position / WORD_BITS];
+        word &= ~((Word)1 << (position % WORD_BITS));
+        // The summary above still stands for any other bits left in this word.
+        if (word != 0)
+          return;
+        position /= WORD_BITS;
+      }
+    }
+
+    /**
+     * Returns true if the button is in the set.
+     */
+    inline boolean test(Index index) const
+    {
+      return (_levels[0][index / WORD_BITS] >> (index % WORD_BITS)) & 1;
+    }
+
+    /**
+     * Returns true if the set is empty.
+     */
+    inline boolean empty() const
+    {
+      return _sizes[0] == 0 || _levels[LEVELS - 1][0] == 0;
+    }
+
+    /**
+     * Finds the lowest member of the set no less than the specified index.
+     *
+     * @param from              Index to start looking from.
+     * @return                  The member found, or NONE if there is none.
+     */
+    Index next(size_t from) const
+    {
+      // Climb until a word has a bit set at or after the position being looked for...
+      size_t position = from;
+      byte level = 0;
+      Word bits = 0;
+      for (;;) {
+        const size_t index = position / WORD_BITS;
+        if (index < _sizes[level]) {
+          bits = _levels[level][index] & ((Word)~(Word)0 << (position % WORD_BITS));
+          if (bits != 0) {
+            position = index * WORD_BITS + lowestBit(bits);
+            break;
+          }
+        }
+        if (++level == LEVELS)
+          return NONE;
+        position = index + 1;
+      }
+
+      // ...then descend, taking the first bit set in each word below it.
+      while (level-- > 0) {
+        position = position * WORD_BITS + lowestBit(_levels[level][position]);
+      }
+      return (Index)position;
+    }
+
+  private:
+
+    /**
+     * Returns the position of the lowest bit set in a word, which must not be zero.
+     * GCC and Clang have a builtin for this, which is a single instruction on ARM (RBIT and CLZ)
+     * and a short library routine on AVR. Elsewhere it is found by halving the word.
+     */
+    static inline byte lowestBit(Word word)
+    {
+#if defined(__GNUC__)
+      return __builtin_ctz(word);
+#else
+      byte bit = 0;
+      for (byte width = WORD_BITS / 2; width > 0; width /= 2) {
+        const Word low = ((Word)1 << width) - 1;
+        if (!(word & low)) {
+          word >>= width;
+          bit += width;
+        }
+      }
+      return bit;
+#endif
+    }
+
+    /**
+     * The words of each level of the bitmap, and how many there are. Level 0 has one bit
+     * per button, and each level above has one bit per word of the level below.
+     */
+    volatile Word* _levels[LEVELS];
+    size_t _sizes[LEVELS];
+};
+
+#endif
@@ -0,0 +1,401 @@
+/*
+ *  Arduino Buttons Library
+ *  An interrupt-driven, fully-debounced class to manage input from physical buttons on the Arduino platform.
+ *
+ *  Copyright (C) 2017 Nicholas Parks Young
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/**
+ * Compile-time configuration for the Buttons library.
+ *
+ * Every option here has a default and may be overridden by defining it before
+ * this file is included, normally from the build flags (e.g. -DBUTTONS_STATISTICS=1).
+ * Optional features default to off so that they cost nothing, in either RAM or
+ * ISR cycles, unless they are asked for.
+ *
+ * Website: https://github.com/Alarm-Siren/arduino-buttons
+ *
+ *  CONFIGURATION FILE
+ *
+ * @author      Nicholas Parks Young
+ * @version     2.0.0
+ */
+
+#ifndef BUTTONS_CONFIG_H
+#define BUTTONS_CONFIG_H
+
+/**
+ * Set to 1 to have the ISR keep per-button bounce statistics, readable
+ * through ButtonsClass::statistics().
+ */
+#ifndef BUTTONS_STATISTICS
+#define BUTTONS_STATISTICS 0
+#endif
+
+/**
+ * Set to 1 to instrument the button ISR with invocation counts, execution times
+ * and the peak interrupt rate, readable through ButtonsClass::isrProfile().
+ */
+#ifndef BUTTONS_ISR_PROFILING
+#define BUTTONS_ISR_PROFILING 0
+#endif
+
+/**
+ * Length in milliseconds of the sliding window over which the peak interrupt rate
+ * is measured when BUTTONS_ISR_PROFILING is enabled.
+ * It is tracked as four sub-windows, so should be a multiple of 4.
+ */
+#ifndef BUTTONS_ISR_RATE_WINDOW
+#define BUTTONS_ISR_RATE_WINDOW 1000
+#endif
+
+/**
+ * Set to 1 to measure, per button, the delay between the ISR accepting a transition
+ * and the application consuming it, readable through ButtonsClass::latencyPercentile().
+ */
+#ifndef BUTTONS_LATENCY_TRACKING
+#define BUTTONS_LATENCY_TRACKING 0
+#endif
+
+/**
+ * Unsigned integer type of the per-button press and release counters behind
+ * ButtonsClass::clickCount(). The counters saturate at the maximum of this type,
+ * so widen it if the application can go a long time between taking counts.
+ */
+#ifndef BUTTONS_CLICK_COUNT_TYPE
+#define BUTTONS_CLICK_COUNT_TYPE uint8_t
+#endif
+
+/**
+ * Unsigned integer type of button IDs, ButtonsClass::ButtonIndex. Either uint8_t, for
+ * up to 255 buttons, or uint16_t, for up to 65535 buttons such as large key matrices
+ * or port expanders. Widening it costs a byte for each ID stored, such as in events.
+ */
+#ifndef BUTTONS_INDEX_TYPE
+#define BUTTONS_INDEX_TYPE uint8_t
+#endif
+
+/**
+ * Set to 1 to run a gesture recogniser on every button, which turns presses and
+ * releases into click, double-click, triple-click, long press and hold events.
+ * Requires ButtonsClass::update() to be called from the main loop.
+ */
+#ifndef BUTTONS_GESTURES
+#define BUTTONS_GESTURES 0
+#endif
+
+/**
+ * Default gesture timings, in milliseconds. These may be changed at run time
+ * with ButtonsClass::setGestureTiming().
+ * A press released before BUTTONS_LONG_PRESS_TIME counts as a click, and further
+ * clicks within BUTTONS_MULTI_CLICK_WINDOW of the last release make it a double or
+ * triple click. A press released between BUTTONS_LONG_PRESS_TIME and BUTTONS_HOLD_TIME
+ * is a long press, and one still down at BUTTONS_HOLD_TIME starts a hold.
+ */
+#ifndef BUTTONS_LONG_PRESS_TIME
+#define BUTTONS_LONG_PRESS_TIME 500
+#endif
+
+#ifndef BUTTONS_HOLD_TIME
+#define BUTTONS_HOLD_TIME 1000
+#endif
+
+#ifndef BUTTONS_MULTI_CLICK_WINDOW
+#define BUTTONS_MULTI_CLICK_WINDOW 250
+#endif
+
+/**
+ * Maximum number of chords (combinations of buttons held together) that can be
+ * registered with ButtonsClass::addChord(), or 0 to compile out chord detection.
+ * Only buttons 0 to 31 can take part in chords.
+ * Requires ButtonsClass::update() to be called from the main loop.
+ */
+#ifndef BUTTONS_MAX_CHORDS
+#define BUTTONS_MAX_CHORDS 0
+#endif
+
+/**
+ * Default time, in milliseconds, within which all the buttons of a chord must be
+ * pressed for it to be recognised.
+ */
+#ifndef BUTTONS_CHORD_TOLERANCE
+#define BUTTONS_CHORD_TOLERANCE 100
+#endif
+
+/**
+ * Maximum number of button sequences (such as up, up, down, down, select) that can be
+ * registered with ButtonsClass::addSequence(), from 1 to 16, or 0 to compile out
+ * sequence recognition.
+ * Requires ButtonsClass::update() to be called from the main loop.
+ */
+#ifndef BUTTONS_MAX_SEQUENCES
+#define BUTTONS_MAX_SEQUENCES 0
+#endif
+
+/**
+ * Longest sequence, in presses, that can be registered.
+ */
+#ifndef BUTTONS_MAX_SEQUENCE_LENGTH
+#define BUTTONS_MAX_SEQUENCE_LENGTH 8
+#endif
+
+/**
+ * Limits on the automaton that recognises all registered sequences at once: the number of
+ * states (at most one per press across all sequences, plus one) and the number of distinct
+ * buttons used across all sequences. The automaton takes the product of the two in bytes
+ * of RAM, and no more than 255 states are allowed.
+ */
+#ifndef BUTTONS_SEQUENCE_STATES
+#define BUTTONS_SEQUENCE_STATES 32
+#endif
+
+#ifndef BUTTONS_SEQUENCE_BUTTONS
+#define BUTTONS_SEQUENCE_BUTTONS 8
+#endif
+
+/**
+ * Default longest time, in milliseconds, allowed between two presses of a sequence.
+ */
+#ifndef BUTTONS_SEQUENCE_TIMEOUT
+#define BUTTONS_SEQUENCE_TIMEOUT 1000
+#endif
+
+/**
+ * Set to 1 to allow buttons to auto-repeat while held, like the keys of a keyboard.
+ * Requires ButtonsClass::update() to be called from the main loop.
+ */
+#ifndef BUTTONS_AUTO_REPEAT
+#define BUTTONS_AUTO_REPEAT 0
+#endif
+
+/**
+ * Default auto-repeat timings, in milliseconds. These may be changed at run time with
+ * ButtonsClass::setAutoRepeatTiming().
+ * The first repeat comes BUTTONS_REPEAT_DELAY after the press, and further repeats every
+ * BUTTONS_REPEAT_INTERVAL after that. Every BUTTONS_REPEAT_ACCELERATE_AFTER repeats the
+ * interval is halved, until it reaches BUTTONS_REPEAT_MIN_INTERVAL.
+ */
+#ifndef BUTTONS_REPEAT_DELAY
+#define BUTTONS_REPEAT_DELAY 500
+#endif
+
+#ifndef BUTTONS_REPEAT_INTERVAL
+#define BUTTONS_REPEAT_INTERVAL 200
+#endif
+
+#ifndef BUTTONS_REPEAT_ACCELERATE_AFTER
+#define BUTTONS_REPEAT_ACCELERATE_AFTER 5
+#endif
+
+#ifndef BUTTONS_REPEAT_MIN_INTERVAL
+#define BUTTONS_REPEAT_MIN_INTERVAL 25
+#endif
+
+/**
+ * Set to 1 to protect against interrupt storms from a broken cable, a floating input or
+ * interference. A button whose pin changes level too often has its interrupt detached and
+ * is polled instead, until its pin has been quiet for a while, and EVENT_QUARANTINE and
+ * EVENT_QUARANTINE_END are reported either side.
+ * Requires ButtonsClass::update() to be called from the main loop.
+ */
+#ifndef BUTTONS_STORM_PROTECTION
+#define BUTTONS_STORM_PROTECTION 0
+#endif
+
+/**
+ * A button is quarantined when its pin changes level BUTTONS_STORM_EDGES times, at most 255,
+ * within BUTTONS_STORM_WINDOW milliseconds. While quarantined it is polled every
+ * BUTTONS_STORM_POLL_INTERVAL milliseconds, which should be longer than the bounce time of
+ * the buttons, and it is returned to interrupts once its pin has held the same level for
+ * BUTTONS_STORM_QUIET_TIME milliseconds.
+ */
+#ifndef BUTTONS_STORM_EDGES
+#define BUTTONS_STORM_EDGES 100
+#endif
+
+#ifndef BUTTONS_STORM_WINDOW
+#define BUTTONS_STORM_WINDOW 100
+#endif
+
+#ifndef BUTTONS_STORM_POLL_INTERVAL
+#define BUTTONS_STORM_POLL_INTERVAL 50
+#endif
+
+#ifndef BUTTONS_STORM_QUIET_TIME
+#define BUTTONS_STORM_QUIET_TIME 2000
+#endif
+
+/**
+ * Set to 1 to allow a function to be called straight from the ISR on the first edge of each
+ * transition, see ButtonsClass::onRawEdge(), for applications that must react within
+ * microseconds. Each such edge is followed by EVENT_EDGE_CONFIRMED or EVENT_EDGE_CANCELLED
+ * once the debounce period shows whether it was real.
+ * Requires ButtonsClass::update() to be called from the main loop.
+ */
+#ifndef BUTTONS_RAW_EDGES
+#define BUTTONS_RAW_EDGES 0
+#endif
+
+/**
+ * Set to 1 to time the first press of each of buttons 0 to 15 in microseconds, and record
+ * which was first, as for a quiz buzzer system; see ButtonsClass::arbitration().
+ * Each of those buttons then has an ISR of its own, so must be on a pin of its own.
+ */
+#ifndef BUTTONS_ARBITRATION
+#define BUTTONS_ARBITRATION 0
+#endif
+
+/**
+ * Maximum number of callbacks that can be registered with ButtonsClass::onPress(),
+ * onRelease(), onChange() and addCallback(), or 0 to compile them out.
+ * Each takes a few bytes of RAM, and each change reported by ButtonsClass::dispatch()
+ * is checked against all of them.
+ */
+#ifndef BUTTONS_MAX_CALLBACKS
+#define BUTTONS_MAX_CALLBACKS 0
+#endif
+
+/**
+ * Set to 1 to make the queues between the ISR and update() lock-free and safe for several
+ * contexts to push into at once. Only the queues are made so: the change flags, click counts,
+ * activity time and the rest of what the ISR updates are still plain read-modify-writes. So the
+ * button interrupts must still not preempt one another, and the library must still be used from
+ * one core. This costs a compare-and-swap per push, and limits BUTTONS_EVENT_QUEUE_SIZE to
+ * between 2 and 64. Without the event queue it has no effect.
+ */
+#ifndef BUTTONS_MPSC_QUEUE
+#define BUTTONS_MPSC_QUEUE 0
+#endif
+
+/**
+ * Width in bits of the time each button keeps of its last change: 32 to keep the whole of
+ * millis(), or 16 or 8 to save two or three bytes of RAM per button. A compact time is kept
+ * in ticks of BUTTONS_TIMESTAMP_TICK milliseconds and only covers a limited range, so
+ * update() brings the times of idle buttons forward before they can wrap round, and
+ * heldFor() and idleFor() stop counting at ButtonsClass::MAX_ELAPSED.
+ * Requires ButtonsClass::update() to be called from the main loop, at least as often as
+ * ButtonsClass::nextDeadline() asks, which will be every quarter of the range. This does
+ * not need the event queue, so leaving that off keeps the RAM saved.
+ */
+#ifndef BUTTONS_TIMESTAMP_BITS
+#define BUTTONS_TIMESTAMP_BITS 32
+#endif
+
+/**
+ * Milliseconds per tick of compact times. Must be a power of two. Defaults to 1 for 16 bits,
+ * for times up to about 32 seconds, and 4 for 8 bits, for times up to about half a second.
+ */
+#ifndef BUTTONS_TIMESTAMP_TICK
+#if BUTTONS_TIMESTAMP_BITS == 8
+#define BUTTONS_TIMESTAMP_TICK 4
+#else
+#define BUTTONS_TIMESTAMP_TICK 1
+#endif
+#endif
+
+/**
+ * Number of buttons, from ID 0, covered by the inline queries ButtonsClass::fastDown(),
+ * fastChanged() and so on, or 0 to compile them out. Each button covered costs the ISR
+ * a bit or two of extra work and a quarter of a byte of RAM.
+ */
+#ifndef BUTTONS_FAST_QUERIES
+#define BUTTONS_FAST_QUERIES 0
+#endif
+
+/**
+ * Set to 1 for debug builds, to check the arguments of calls that otherwise trust them,
+ * such as the button IDs passed to down(), changed(), clearChangeFlag() and the fast queries.
+ * Those calls then return false, or do nothing, rather than reach outside the buttons.
+ */
+#ifndef BUTTONS_DEBUG
+#define BUTTONS_DEBUG 0
+#endif
+
+/**
+ * Capacity of the event queues behind ButtonsClass::readEvent(). Must be a power
+ * of two no greater than 128, or 0 to compile out events and update() altogether.
+ * Defaults to 8 when a feature that produces events is enabled, and 0 otherwise.
+ */
+#ifndef BUTTONS_EVENT_QUEUE_SIZE
+#if BUTTONS_GESTURES || BUTTONS_MAX_CHORDS || BUTTONS_MAX_SEQUENCES || BUTTONS_AUTO_REPEAT \
+    || BUTTONS_STORM_PROTECTION || BUTTONS_RAW_EDGES
+#define BUTTONS_EVENT_QUEUE_SIZE 8
+#else
+#define BUTTONS_EVENT_QUEUE_SIZE 0
+#endif
+#endif
+
+/**
+ * Set when ButtonsClass::update() is needed: for the event queue, or to look after compact times.
+ */
+#define BUTTONS_HAS_UPDATE (BUTTONS_EVENT_QUEUE_SIZE || BUTTONS_TIMESTAMP_BITS < 32)
+
+#if BUTTONS_GESTURES && !BUTTONS_EVENT_QUEUE_SIZE
+#error "BUTTONS_GESTURES requires a non-zero BUTTONS_EVENT_QUEUE_SIZE"
+#endif
+
+#if BUTTONS_MAX_CHORDS && !BUTTONS_EVENT_QUEUE_SIZE
+#error "BUTTONS_MAX_CHORDS requires a non-zero BUTTONS_EVENT_QUEUE_SIZE"
+#endif
+
+#if BUTTONS_MAX_SEQUENCES && !BUTTONS_EVENT_QUEUE_SIZE
+#error "BUTTONS_MAX_SEQUENCES requires a non-zero BUTTONS_EVENT_QUEUE_SIZE"
+#endif
+
+#if BUTTONS_AUTO_REPEAT && !BUTTONS_EVENT_QUEUE_SIZE
+#error "BUTTONS_AUTO_REPEAT requires a non-zero BUTTONS_EVENT_QUEUE_SIZE"
+#endif
+
+#if BUTTONS_STORM_PROTECTION && !BUTTONS_EVENT_QUEUE_SIZE
+#error "BUTTONS_STORM_PROTECTION requires a non-zero BUTTONS_EVENT_QUEUE_SIZE"
+#endif
+
+#if BUTTONS_RAW_EDGES && !BUTTONS_EVENT_QUEUE_SIZE
+#error "BUTTONS_RAW_EDGES requires a non-zero BUTTONS_EVENT_QUEUE_SIZE"
+#endif
+
+#if BUTTONS_STORM_EDGES < 1 || BUTTONS_STORM_EDGES > 255
+#error "BUTTONS_STORM_EDGES must be from 1 to 255"
+#endif
+
+#if BUTTONS_MAX_SEQUENCES > 16 || BUTTONS_SEQUENCE_STATES > 255
+#error "BUTTONS_MAX_SEQUENCES must be no greater than 16, and BUTTONS_SEQUENCE_STATES no greater than 255"
+#endif
+
+#if BUTTONS_MAX_CHORDS > 127
+#error "BUTTONS_MAX_CHORDS must be no greater than 127"
+#endif
+
+#if BUTTONS_TIMESTAMP_BITS != 8 && BUTTONS_TIMESTAMP_BITS != 16 && BUTTONS_TIMESTAMP_BITS != 32
+#error "BUTTONS_TIMESTAMP_BITS must be 8, 16 or 32"
+#endif
+
+#if BUTTONS_TIMESTAMP_TICK < 1 || (BUTTONS_TIMESTAMP_TICK & (BUTTONS_TIMESTAMP_TICK - 1)) \
+    || (BUTTONS_TIMESTAMP_BITS == 32 && BUTTONS_TIMESTAMP_TICK != 1)
+#error "BUTTONS_TIMESTAMP_TICK must be a power of two, and 1 when BUTTONS_TIMESTAMP_BITS is 32"
+#endif
+
+#if BUTTONS_MPSC_QUEUE && BUTTONS_EVENT_QUEUE_SIZE && (BUTTONS_EVENT_QUEUE_SIZE < 2 || BUTTONS_EVENT_QUEUE_SIZE > 64)
+#error "BUTTONS_EVENT_QUEUE_SIZE must be from 2 to 64 when BUTTONS_MPSC_QUEUE is set"
+#endif
+
+#if BUTTONS_MAX_CALLBACKS > 127
+#error "BUTTONS_MAX_CALLBACKS must be no greater than 127"
+#endif
+
+#endif
@@ -0,0 +1,420 @@
+/*
+ *  Arduino Buttons Library
+ *  An interrupt-driven, fully-debounced class to manage input from physical buttons on the Arduino platform.
+ *
+ *  Copyright (C) 2017 Nicholas Parks Young
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/**
+ * Fixed-size queues used to pass button events from the ISR to the main program,
+ * and from the library to the application.
+ *
+ * Website: https://github.com/Alarm-Siren/arduino-buttons
+ *
+ *  DEFINITION FILE
+ *
+ * @author      Nicholas Parks Young
+ * @version     2.0.0
+ */
+
+#ifndef BUTTONS_QUEUE_H
+#define BUTTONS_QUEUE_H
+
+#include <Arduino.h>
+
+/**
+ * Stops the compiler moving memory accesses across this point.
+ * Sufficient to order accesses between an ISR and the main program on a single core.
+ */
+#define BUTTONS_COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+/**
+ * Set when the compiler can compare-and-swap a byte and a 16-bit word in line. It cannot on
+ * Cortex-M0 and M0+ (ARMv6-M) or on AVR, where GCC instead calls __atomic library functions
+ * that the Arduino cores do not provide, so ButtonsMpscRing holds off interrupts instead.
+ */
+#ifndef BUTTONS_INLINE_CAS
+#if !defined(__ARM_ARCH_6M__) && !defined(__AVR__) \
+    && __GCC_ATOMIC_CHAR_LOCK_FREE == 2 && __GCC_ATOMIC_SHORT_LOCK_FREE == 2
+#define BUTTONS_INLINE_CAS 1
+#else
+#define BUTTONS_INLINE_CAS 0
+#endif
+#endif
+
+/**
+ * A single-producer, single-consumer ring buffer of fixed capacity.
+ * One side (typically an ISR) may push while the other pops, with no locking,
+ * provided each side is only ever used from one context at a time.
+ * When full, pushes are dropped and counted rather than overwriting older items.
+ *
+ * @param T         Type of the items held. Must be trivially copyable.
+ * @param SIZE      Capacity of the queue. Must be a power of two no greater than 128.
+ */
+template <typename T, byte SIZE>
+class ButtonsRing final
+{
+  static_assert(SIZE > 0 && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0,
+                "ButtonsRing SIZE must be a power of two no greater than 128");
+
+  public:
+
+    ButtonsRing() :
+      _head(0),
+      _tail(0),
+      _overflows(0)
+    { }
+
+    /**
+     * Adds an item to the back of the queue. Producer side only.
+     *
+     * @param item              The item to add.
+     * @return                  true on success, false if the queue was full.
+     */
+    boolean push(const T& item)
+    {
+      const byte head = _head;
+      if ((byte)(head - _tail) >= SIZE) {
+        if (_overflows != UINT16_MAX)
+          _overflows++;
+        return false;
+      }
+      _items[head & (SIZE - 1)] = item;
+      // The item must be in place before the consumer can see it.
+      BUTTONS_COMPILER_BARRIER();
+      _head = head + 1;
+      return true;
+    }
+
+    /**
+     * Removes the item at the front of the queue. Consumer side only.
+     *
+     * @param item              Receives the removed item.
+     * @return                  true on success, false if the queue was empty.
+     */
+    boolean pop(T& item)
+    {
+      const byte tail = _tail;
+      if (tail == _head)
+        return false;
+      item = _items[tail & (SIZE - 1)];
+      // The item must be copied out before the producer can reuse its slot.
+      BUTTONS_COMPILER_BARRIER();
+      _tail = tail + 1;
+      return true;
+    }
+
+    /**
+     * Returns true if there is nothing in the queue.
+     */
+    boolean empty() const
+    {
+      return _head == _tail;
+    }
+
+    /**
+     * Discards everything in the queue. Consumer side only.
+     */
+    void clear()
+    {
+      _tail = _head;
+    }
+
+    /**
+     * Returns the number of items dropped because the queue was full.
+     */
+    uint16_t overflows() const
+    {
+      return _overflows;
+    }
+
+  private:
+
+    /**
+     * Storage for the queued items.
+     */
+    T _items[SIZE];
+
+    /**
+     * Free-running count of items pushed and popped respectively.
+     * Only the low bits are used as an index, so these may wrap freely.
+     */
+    volatile byte _head;
+    volatile byte _tail;
+
+    /**
+     * Number of items dropped because the queue was full. Saturates.
+     */
+    volatile uint16_t _overflows;
+};
+
+/**
+ * A multiple-producer, single-consumer ring buffer of fixed capacity, for when items are
+ * pushed from several ISRs that can preempt one another, such as ISRs at different NVIC
+ * priorities on Cortex-M. Any number of contexts may push at once, while one pops.
+ * When full, pushes are dropped and counted rather than overwriting older items.
+ *
+ * Each slot carries a sequence number saying whose turn it is: the producer that will next
+ * fill it, or the consumer that will next empty it. A producer claims a slot by advancing
+ * the head with compare-and-swap, fills it, then publishes it by updating its sequence, so
+ * a producer preempted part-way through holds up only the consumer, and only at that slot.
+ * The atomic operations are the compiler's __atomic builtins, which use LDREX/STREX on
+ * Cortex-M3 and above. Without BUTTONS_INLINE_CAS, as on Cortex-M0/M0+ and AVR, each one
+ * instead briefly holds off interrupts, which is only safe between contexts on one core.
+ *
+ * @param T         Type of the items held. Must be trivially copyable.
+ * @param SIZE      Capacity of the queue. Must be a power of two from 2 to 64.
+ */
+template <typename T, byte SIZE>
+class ButtonsMpscRing final
+{
+  static_assert(SIZE >= 2 && SIZE <= 64 && (SIZE & (SIZE - 1)) == 0,
+                "ButtonsMpscRing SIZE must be a power of two from 2 to 64");
+
+  public:
+
+    ButtonsMpscRing() :
+      _head(0),
+      _tail(0),
+      _overflows(0)
+    {
+      for (byte i = 0; i < SIZE; i++) {
+        _slots[i].sequence = i;
+      }
+    }
+
+    /**
+     * Adds an item to the back of the queue. May be called from any context.
+     *
+     * @param item              The item to add.
+     * @return                  true on success, false if the queue was full.
+     */
+    boolean push(const T& item)
+    {
+      byte head = load<__ATOMIC_RELAXED>(&_head);
+      Slot* slot;
+      for (;;) {
+        slot = &_slots[head & (SIZE - 1)];
+        const int8_t turn = (int8_t)(load<__ATOMIC_ACQUIRE>(&slot->sequence) - head);
+        if (turn == 0) {
+          // The slot is free; claim it, unless another producer got there first.
+          if (compareExchange(&_head, head, (byte)(head + 1)))
+            break;
+        } else if (turn < 0) {
+          // The slot still holds the item from one lap ago: the queue is full.
+          countOverflow();
+          return false;
+        } else {
+          // Another producer has claimed this slot since the head was read.
+          head = load<__ATOMIC_RELAXED>(&_head);
+        }
+      }
+
+      slot->item = item;
+      store<__ATOMIC_RELEASE>(&slot->sequence, (byte)(head + 1));
+      return true;
+    }
+
+    /**
+     * Removes the item at the front of the queue. Consumer side only.
+     *
+     * @param item              Receives the removed item.
+     * @return                  true on success, false if the queue was empty, or the item at
+     *                          the front has been claimed but not yet filled.
+     */
+    boolean pop(T& item)
+    {
+      const byte tail = _tail;
+      Slot& slot = _slots[tail & (SIZE - 1)];
+      if (load<__ATOMIC_ACQUIRE>(&slot.sequence) != (byte)(tail + 1))
+        return false;
+
+      item = slot.item;
+      // Hand the slot on to the producer that will fill it on the next lap.
+      store<__ATOMIC_RELEASE>(&slot.sequence, (byte)(tail + SIZE));
+      _tail = tail + 1;
+      return true;
+    }
+
+    /**
+     * Returns true if there is nothing in the queue ready to pop. Consumer side only.
+     */
+    boolean empty() const
+    {
+      return load<__ATOMIC_ACQUIRE>(&_slots[_tail & (SIZE - 1)].sequence) != (byte)(_tail + 1);
+    }
+
+    /**
+     * Discards everything in the queue. Consumer side only.
+     */
+    void clear()
+    {
+      T item;
+      while (pop(item)) { }
+    }
+
+    /**
+     * Returns the number of items dropped because the queue was full.
+     */
+    uint16_t overflows() const
+    {
+      return load<__ATOMIC_RELAXED>(&_overflows);
+    }
+
+  private:
+
+    /**
+     * A slot of the queue and its sequence number: the value of the head at which a producer
+     * may fill it, or one more than the value of the tail at which it may be popped.
+     */
+    struct Slot
+    {
+      byte sequence;
+      T item;
+    };
+
+    /**
+     * Adds one to the overflow count, unless it has saturated.
+     */
+    void countOverflow()
+    {
+      uint16_t count = load<__ATOMIC_RELAXED>(&_overflows);
+      while (count != UINT16_MAX && !compareExchange(&_overflows, count, (uint16_t)(count + 1))) { }
+    }
+
+#if BUTTONS_INLINE_CAS
+    /**
+     * The atomic operations used by the queue: the __atomic builtins of the same names.
+     * compareExchange() is relaxed, and may fail spuriously.
+     */
+    template <int ORDER, typename U>
+    static U load(const U* value)
+    {
+      return __atomic_load_n(value, ORDER);
+    }
+
+    template <int ORDER, typename U>
+    static void store(U* value, U desired)
+    {
+      __atomic_store_n(value, desired, ORDER);
+    }
+
+    template <typename U>
+    static boolean compareExchange(U* value, U& expected, U desired)
+    {
+      return __atomic_compare_exchange_n(value, &expected, desired, true,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+#else
+    /**
+     * The atomic operations used by the queue, made so by holding off interrupts. The
+     * ORDER asked for is always met, as holding off interrupts is also a compiler barrier.
+     */
+    template <int ORDER, typename U>
+    static U load(const U* value)
+    {
+      const InterruptState state = holdInterrupts();
+      const U result = *value;
+      restoreInterrupts(state);
+      return result;
+    }
+
+    template <int ORDER, typename U>
+    static void store(U* value, U desired)
+    {
+      const InterruptState state = holdInterrupts();
+      *value = desired;
+      restoreInterrupts(state);
+    }
+
+    template <typename U>
+    static boolean compareExchange(U* value, U& expected, U desired)
+    {
+      const InterruptState state = holdInterrupts();
+      const boolean swapped = (*value == expected);
+      if (swapped)
+        *value = desired;
+      else
+        expected = *value;
+      restoreInterrupts(state);
+      return swapped;
+    }
+
+    /**
+     * Holds off interrupts, returning their previous state to be put back by restoreInterrupts().
+     * Unlike noInterrupts() and interrupts(), these may be nested, so push() may be called from
+     * an ISR or with interrupts already disabled.
+     */
+#if defined(__AVR__)
+    typedef uint8_t InterruptState;
+
+    static InterruptState holdInterrupts()
+    {
+      const InterruptState state = SREG;
+      cli();
+      return state;
+    }
+
+    static void restoreInterrupts(InterruptState state)
+    {
+      BUTTONS_COMPILER_BARRIER();
+      SREG = state;
+    }
+#elif defined(__arm__)
+    typedef uint32_t InterruptState;
+
+    static InterruptState holdInterrupts()
+    {
+      InterruptState state;
+      __asm__ __volatile__("mrs %0, primask\n\tcpsid i" : "=r" (state) :: "memory");
+      return state;
+    }
+
+    static void restoreInterrupts(InterruptState state)
+    {
+      __asm__ __volatile__("msr primask, %0" :: "r" (state) : "memory");
+    }
+#else
+    typedef byte InterruptState;
+
+    static InterruptState holdInterrupts()
+    {
+      static_assert(sizeof(T) == 0, "ButtonsMpscRing needs BUTTONS_INLINE_CAS on this core");
+      return 0;
+    }
+
+    static void restoreInterrupts(InterruptState) { }
+#endif
+#endif
+
+    Slot _slots[SIZE];
+
+    /**
+     * Free-running count of slots claimed by producers and items popped respectively.
+     * Only the low bits are used as an index, so these may wrap freely.
+     */
+    byte _head;
+    byte _tail;
+
+    /**
+     * Number of items dropped because the queue was full. Saturates.
+     */
+    uint16_t _overflows;
+};
+
+#endif
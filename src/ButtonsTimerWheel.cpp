@@ -0,0 +1,226 @@
+/*
+ *  Arduino Buttons Library
+ *  An interrupt-driven, fully-debounced class to manage input from physical buttons on the Arduino platform.
+ *
+ *  Copyright (C) 2017 Nicholas Parks Young
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/**
+ * Hierarchical timer wheel used to schedule the library's timing deadlines
+ * (gestures, auto-repeat, chords, debounce confirmation) in constant time.
+ *
+ * Website: https://github.com/Alarm-Siren/arduino-buttons
+ *
+ *  IMPLEMENTATION FILE
+ *
+ * @author      Nicholas Parks Young
+ * @version     2.0.0
+ */
+
+#include "ButtonsTimerWheel.h"
+
+static_assert(ButtonsTimerWheel::SLOTS <= 16, "ButtonsTimerWheel occupancy masks are 16 bits");
+static_assert(ButtonsTimerWheel::LEVELS * ButtonsTimerWheel::SLOTS < ButtonsTimer::UNLINKED,
+              "ButtonsTimerWheel slot indices must fit in a byte");
+
+ButtonsTimerWheel::ButtonsTimerWheel() :
+  _slots(),
+  _occupied(),
+  _time(0),
+  _count(0)
+{ }
+
+void ButtonsTimerWheel::reset(unsigned long now)
+{
+  for (byte i = 0; i <= OVERFLOW_SLOT; i++) {
+    _slots[i] = nullptr;
+  }
+  for (byte level = 0; level < LEVELS; level++) {
+    _occupied[level] = 0;
+  }
+  _time = now;
+  _count = 0;
+}
+
+void ButtonsTimerWheel::schedule(ButtonsTimer& timer, unsigned long deadline)
+{
+  if (timer.armed())
+    unlink(timer);
+
+  timer.deadline = deadline;
+  insert(timer);
+  _count++;
+}
+
+void ButtonsTimerWheel::cancel(ButtonsTimer& timer)
+{
+  if (!timer.armed())
+    return;
+
+  unlink(timer);
+  _count--;
+}
+
+ButtonsTimer* ButtonsTimerWheel::expire(unsigned long now)
+{
+  while ((long)(now - _time) >= 0) {
+    // Everything in the current slot of the first wheel is due now.
+    const byte index = _time & SLOT_MASK;
+    if (_occupied[0] & (1U << index)) {
+      ButtonsTimer* const timer = _slots[index];
+      unlink(*timer);
+      _count--;
+      return timer;
+    }
+
+    // Skip ahead to the next occupied slot of the first wheel, or to the point where it
+    // comes round, whichever is sooner, but no further than we've been asked to go.
+    // Stopping on now rather than after it means a timer scheduled for now, or earlier,
+    // before the next call is filed in a slot that call will still look at.
+    byte step = SLOTS - index;
+    const uint16_t ahead = _occupied[0] >> (index + 1);
+    if (ahead != 0) {
+      step = 1;
+      while (!(ahead & (1U << (step - 1)))) {
+        step++;
+      }
+    }
+    if ((long)(now - _time) < (long)step) {
+      _time = now;
+      break;
+    }
+
+    _time += step;
+    if ((_time & SLOT_MASK) == 0)
+      cascade(1);
+  }
+  return nullptr;
+}
+
+boolean ButtonsTimerWheel::nextDeadline(unsigned long& deadline) const
+{
+  if (_count == 0)
+    return false;
+
+  // The first occupied slot of each wheel, counting round from the current time, holds that
+  // wheel's earliest timers, but the wheels overlap so the earliest of them all must be found.
+  // On the first wheel each slot is exactly one millisecond, so only the slot need be found.
+  boolean found = false;
+  for (byte level = 0; level < LEVELS; level++) {
+    if (_occupied[level] == 0)
+      continue;
+
+    const byte current = (_time >> (level * SLOT_BITS)) & SLOT_MASK;
+    const byte first = (level == 0) ? 0 : 1;
+    for (byte offset = first; offset < SLOTS + first; offset++) {
+      const byte index = (current + offset) & SLOT_MASK;
+      if (!(_occupied[level] & (1U << index)))
+        continue;
+
+      if (level == 0) {
+        deadline = _time + offset;
+        found = true;
+      } else {
+        for (const ButtonsTimer* timer = _slots[level * SLOTS + index]; timer; timer = timer->next) {
+          if (!found || (long)(timer->deadline - deadline) < 0) {
+            deadline = timer->deadline;
+            found = true;
+          }
+        }
+      }
+      break;
+    }
+  }
+
+  for (const ButtonsTimer* timer = _slots[OVERFLOW_SLOT]; timer; timer = timer->next) {
+    if (!found || (long)(timer->deadline - deadline) < 0) {
+      deadline = timer->deadline;
+      found = true;
+    }
+  }
+
+  return found;
+}
+
+void ButtonsTimerWheel::insert(ButtonsTimer& timer)
+{
+  // Deadlines already passed are filed against the current time, so they expire next.
+  long delta = (long)(timer.deadline - _time);
+  unsigned long key = timer.deadline;
+  if (delta < 0) {
+    delta = 0;
+    key = _time;
+  }
+
+  byte slot = OVERFLOW_SLOT;
+  for (byte level = 0; level < LEVELS; level++) {
+    if ((unsigned long)delta < (1UL << ((level + 1) * SLOT_BITS))) {
+      const byte index = (key >> (level * SLOT_BITS)) & SLOT_MASK;
+      slot = level * SLOTS + index;
+      _occupied[level] |= (1U << index);
+      break;
+    }
+  }
+
+  timer.slot = slot;
+  timer.prev = nullptr;
+  timer.next = _slots[slot];
+  if (timer.next)
+    timer.next->prev = &timer;
+  _slots[slot] = &timer;
+}
+
+void ButtonsTimerWheel::unlink(ButtonsTimer& timer)
+{
+  const byte slot = timer.slot;
+
+  if (timer.prev) {
+    timer.prev->next = timer.next;
+  } else {
+    _slots[slot] = timer.next;
+  }
+  if (timer.next)
+    timer.next->prev = timer.prev;
+
+  if (slot != OVERFLOW_SLOT && !_slots[slot])
+    _occupied[slot / SLOTS] &= ~(1U << (slot % SLOTS));
+
+  timer.next = nullptr;
+  timer.prev = nullptr;
+  timer.slot = ButtonsTimer::UNLINKED;
+}
+
+void ButtonsTimerWheel::cascade(byte level)
+{
+  byte slot = OVERFLOW_SLOT;
+  if (level < LEVELS) {
+    const byte index = (_time >> (level * SLOT_BITS)) & SLOT_MASK;
+    if (index == 0)
+      cascade(level + 1);
+    slot = level * SLOTS + index;
+    _occupied[level] &= ~(1U << index);
+  }
+
+  ButtonsTimer* timer = _slots[slot];
+  _slots[slot] = nullptr;
+  while (timer) {
+    ButtonsTimer* const next = timer->next;
+    insert(*timer);
+    timer = next;
+  }
+}
@@ -0,0 +1,210 @@
+/*
+ *  Arduino Buttons Library
+ *  An interrupt-driven, fully-debounced class to manage input from physical buttons on the Arduino platform.
+ *
+ *  Copyright (C) 2017 Nicholas Parks Young
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/**
+ * Hierarchical timer wheel used to schedule the library's timing deadlines
+ * (gestures, auto-repeat, chords, debounce confirmation) in constant time.
+ *
+ * Website: https://github.com/Alarm-Siren/arduino-buttons
+ *
+ *  DEFINITION FILE
+ *
+ * @author      Nicholas Parks Young
+ * @version     2.0.0
+ */
+
+#ifndef BUTTONS_TIMER_WHEEL_H
+#define BUTTONS_TIMER_WHEEL_H
+
+#include <Arduino.h>
+
+/**
+ * A single timer that can be scheduled on a ButtonsTimerWheel.
+ * The storage for timers belongs to whoever owns them; the wheel only links them together.
+ */
+struct ButtonsTimer
+{
+  /**
+   * Links to the neighbouring timers in the same wheel slot.
+   */
+  ButtonsTimer* next;
+  ButtonsTimer* prev;
+
+  /**
+   * Value of millis() at which the timer expires.
+   */
+  unsigned long deadline;
+
+  /**
+   * Index of the wheel slot the timer is in, or UNLINKED if it is not scheduled.
+   */
+  byte slot;
+
+  /**
+   * Free for the owner to record what the timer is for.
+   */
+  byte kind;
+  uint16_t index;
+
+  static const byte UNLINKED = 0xFF;
+
+  ButtonsTimer() :
+    next(nullptr),
+    prev(nullptr),
+    deadline(0),
+    slot(UNLINKED),
+    kind(0),
+    index(0)
+  { }
+
+  /**
+   * Returns true if the timer is scheduled.
+   */
+  boolean armed() const
+  {
+    return slot != UNLINKED;
+  }
+};
+
+/**
+ * A hierarchical timer wheel with millisecond resolution.
+ *
+ * There are LEVELS wheels of SLOTS slots each. The first has one slot per millisecond, and each
+ * further wheel has slots SLOTS times as long as the one before, so a timer is filed by how far
+ * away its deadline is. Each time the first wheel comes round, the next slot of the second is
+ * emptied into it, and so on up the levels. Timers too far away for any wheel are kept on an
+ * overflow list, which is re-filed each time the last wheel comes round.
+ *
+ * This makes scheduling and cancelling O(1), and expiry amortised O(1) per timer, however many
+ * timers there are. Runs of empty slots are skipped, so catching up after a long gap is cheap.
+ */
+class ButtonsTimerWheel final
+{
+  public:
+
+    /**
+     * Number of bits of the deadline each wheel covers, and so the number of slots per wheel.
+     */
+    static const byte SLOT_BITS = 4;
+    static const byte SLOTS = 1 << SLOT_BITS;
+
+    /**
+     * Number of wheels. Timers more than SLOTS ^ LEVELS milliseconds away go on the overflow list.
+     */
+    static const byte LEVELS = 4;
+
+    ButtonsTimerWheel();
+
+    /**
+     * Forgets every scheduled timer, without touching the timers themselves,
+     * and sets the current time of the wheel.
+     *
+     * @param now               Current value of millis().
+     */
+    void reset(unsigned long now);
+
+    /**
+     * Schedules a timer, first cancelling it if it was already scheduled.
+     * A deadline that has already passed expires on the next call to expire().
+     *
+     * @param timer             The timer.
+     * @param deadline          Value of millis() at which the timer is to expire.
+     */
+    void schedule(ButtonsTimer& timer, unsigned long deadline);
+
+    /**
+     * Cancels a timer, if it is scheduled.
+     *
+     * @param timer             The timer.
+     */
+    void cancel(ButtonsTimer& timer);
+
+    /**
+     * Removes and returns one timer whose deadline is at or before the specified time.
+     * Timers are returned in deadline order, so call this repeatedly until it returns nullptr.
+     * The caller may schedule timers between calls.
+     *
+     * @param now               Current value of millis().
+     * @return                  A timer that has expired, or nullptr if there are none.
+     */
+    ButtonsTimer* expire(unsigned long now);
+
+    /**
+     * Finds the earliest deadline of any scheduled timer.
+     * This looks at no more than one slot of each wheel, plus the overflow list.
+     *
+     * @param deadline          Receives the earliest deadline, if there is one.
+     * @return                  true if any timer is scheduled, false otherwise.
+     */
+    boolean nextDeadline(unsigned long& deadline) const;
+
+    /**
+     * Returns true if no timer is scheduled.
+     */
+    boolean empty() const
+    {
+      return _count == 0;
+    }
+
+  private:
+
+    static const byte SLOT_MASK = SLOTS - 1;
+    static const byte OVERFLOW_SLOT = LEVELS * SLOTS;
+
+    /**
+     * Files a timer into the slot appropriate to its deadline.
+     */
+    void insert(ButtonsTimer& timer);
+
+    /**
+     * Unlinks a timer from its slot.
+     */
+    void unlink(ButtonsTimer& timer);
+
+    /**
+     * Re-files the timers in the current slot of the specified wheel, having first done
+     * the same for the next wheel up if this one has just come round.
+     */
+    void cascade(byte level);
+
+    /**
+     * Heads of the timer lists for each slot of each wheel, then the overflow list.
+     */
+    ButtonsTimer* _slots[LEVELS * SLOTS + 1];
+
+    /**
+     * One bit per slot of each wheel, set when that slot is not empty.
+     */
+    uint16_t _occupied[LEVELS];
+
+    /**
+     * The millisecond expire() has got up to. Every timer due before this has expired.
+     */
+    unsigned long _time;
+
+    /**
+     * Number of timers scheduled.
+     */
+    uint16_t _count;
+};
+
+#endif